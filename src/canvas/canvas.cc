@@ -105,7 +105,8 @@ void Canvas::DrawRect(Rasterizer& rasterizer, Rect rect, const Paint& paint) {
 
   auto pipeline = context_->GetPipeline();
 
-  pipeline->color_desc = paint.color_desc.value_or(ColorAttachmentDescriptor{});
+  pipeline->color_descs[0] =
+      paint.color_desc.value_or(ColorAttachmentDescriptor{});
 
   pipeline->depth_desc = paint.depth_desc.value_or(DepthAttachmentDescriptor{});
 
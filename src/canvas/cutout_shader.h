@@ -0,0 +1,58 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include "image.h"
+#include "invocation.h"
+#include "macros.h"
+#include "shader.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// @brief      Draws a texture and discards all fragments whose alpha is below
+///             a cutoff. Useful for foliage and glyphs that don't need to be
+///             blended.
+///
+class CutoutShader final : public Shader {
+ public:
+  struct VertexData {
+    glm::vec2 texture_coords;
+    glm::vec3 position;
+  };
+
+  struct Uniforms {
+    ScalarF alpha_cutoff;
+  };
+
+  struct Varyings {
+    glm::vec2 texture_coords;
+  };
+
+  CutoutShader() = default;
+
+  size_t GetVaryingsSize() const override { return sizeof(Varyings); }
+
+  bool MayDiscard() const override { return true; }
+
+  glm::vec4 ProcessVertex(const VertexInvocation& inv) const override {
+    FORWARD(texture_coords, texture_coords);
+    return {VTX(position), 1};
+  }
+
+  glm::vec4 ProcessFragment(const FragmentInvocation& inv) const override {
+    auto color = inv.LoadImage(0).Sample(VARYING_LOAD(texture_coords));
+    if (color.a < UNIFORM(alpha_cutoff)) {
+      inv.Discard();
+    }
+    return color;
+  }
+
+ private:
+  SFT_DISALLOW_COPY_AND_ASSIGN(CutoutShader);
+};
+
+}  // namespace sft
@@ -0,0 +1,6 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "gbuffer_shader.h"
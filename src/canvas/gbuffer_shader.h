@@ -0,0 +1,86 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include "invocation.h"
+#include "macros.h"
+#include "shader.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// @brief      Writes the albedo, normal and ID of a primitive into the first
+///             three color attachments in a single pass. Useful for deferred
+///             shading and picking.
+///
+class GBufferShader final : public Shader {
+ public:
+  static constexpr size_t kAlbedoLocation = 0;
+  static constexpr size_t kNormalLocation = 1;
+  static constexpr size_t kIDLocation = 2;
+
+  struct VertexData {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  struct Uniforms {
+    glm::vec4 albedo;
+    uint32_t id = 0;
+  };
+
+  struct Varyings {
+    glm::vec3 normal;
+  };
+
+  GBufferShader() = default;
+
+  size_t GetVaryingsSize() const override { return sizeof(Varyings); }
+
+  glm::vec4 ProcessVertex(const VertexInvocation& inv) const override {
+    FORWARD(normal, normal);
+    return {VTX(position), 1};
+  }
+
+  glm::vec4 ProcessFragment(const FragmentInvocation& inv) const override {
+    return UNIFORM(albedo);
+  }
+
+  void ProcessFragmentBatch(FragmentBatch& batch) const override {
+    const auto albedo =
+        batch.LoadUniform<glm::vec4>(offsetof(Uniforms, albedo));
+    const auto id =
+        EncodeID(batch.LoadUniform<uint32_t>(offsetof(Uniforms, id)));
+    const auto normal =
+        batch.LoadVarying<glm::vec3>(offsetof(Varyings, normal));
+    for (size_t i = 0; i < batch.GetCount(); i++) {
+      batch.StoreColor(i, albedo, kAlbedoLocation);
+      batch.StoreColor(i, EncodeNormal(normal[i]), kNormalLocation);
+      batch.StoreColor(i, id, kIDLocation);
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the ID stored in a color of the ID attachment.
+  ///
+  static uint32_t DecodeID(Color color) { return color.color; }
+
+ private:
+  static glm::vec4 EncodeNormal(const glm::vec3& normal) {
+    return {glm::normalize(normal) * 0.5f + 0.5f, 1.0f};
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Spread the bytes of the ID over the channels of a color. They
+  ///             are stored exactly as long as the ID attachment isn't
+  ///             blended.
+  ///
+  static glm::vec4 EncodeID(uint32_t id) { return Color{id}; }
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(GBufferShader);
+};
+
+}  // namespace sft
@@ -5,10 +5,36 @@
 
 #include "model.h"
 
+#include <unordered_map>
+
 namespace sft {
 
+struct VertexHash {
+  size_t operator()(const ModelShader::VertexData& vertex) const {
+    const ScalarF components[] = {
+        vertex.position.x,      vertex.position.y, vertex.position.z,
+        vertex.normal.x,        vertex.normal.y,   vertex.normal.z,
+        vertex.texture_coord.x, vertex.texture_coord.y,
+    };
+    size_t hash = 0;
+    for (const auto component : components) {
+      hash ^= std::hash<ScalarF>{}(component) + 0x9e3779b9 + (hash << 6) +
+              (hash >> 2);
+    }
+    return hash;
+  }
+};
+
+struct VertexEqual {
+  bool operator()(const ModelShader::VertexData& a,
+                  const ModelShader::VertexData& b) const {
+    return a.position == b.position && a.normal == b.normal &&
+           a.texture_coord == b.texture_coord;
+  }
+};
+
 Model::Model(std::string path, std::string base_dir)
-    : vertex_buffer_(Buffer::Create()) {
+    : vertex_buffer_(Buffer::Create()), index_buffer_(Buffer::Create()) {
   std::string warnings;
   std::string errors;
   tinyobj::attrib_t attrib;
@@ -61,7 +87,7 @@ Model::Model(std::string path, std::string base_dir)
         }
 
         // Texture coords.
-        glm::vec2 texture_coord;
+        glm::vec2 texture_coord = {};
         if (idx.texcoord_index >= 0) {
           texture_coord =
               glm::vec2({attrib.texcoords[2 * idx.texcoord_index + 0],
@@ -92,17 +118,39 @@ Model::Model(std::string path, std::string base_dir)
     }
   }
 
-  vertex_count_ = vertices.size();
-  vertex_buffer_->Emplace(std::move(vertices));
+  // Share identical vertices between faces so that the rasterizer can cache
+  // the results of the vertex shader.
+  std::vector<ModelShader::VertexData> unique_vertices;
+  std::vector<uint32_t> indices;
+  std::unordered_map<ModelShader::VertexData, uint32_t, VertexHash,
+                     VertexEqual>
+      vertex_indices;
+  indices.reserve(vertices.size());
+  vertex_indices.reserve(vertices.size());
+  for (const auto& vertex : vertices) {
+    const auto [found, inserted] =
+        vertex_indices.try_emplace(vertex, unique_vertices.size());
+    if (inserted) {
+      unique_vertices.push_back(vertex);
+    }
+    indices.push_back(found->second);
+  }
+
+  index_count_ = indices.size();
+  vertex_buffer_->Emplace(std::move(unique_vertices));
+  index_buffer_->Emplace(std::move(indices));
 
   pipeline_ = std::make_shared<Pipeline>();
   pipeline_->depth_desc.depth_test_enabled = true;
   pipeline_->cull_face = CullFace::kBack;
+  // Matches the projection used to render the model.
+  pipeline_->clip_depth_range = ClipDepthRange::kZeroToOne;
   model_shader_ = std::make_shared<ModelShader>();
   pipeline_->shader = model_shader_;
   pipeline_->vertex_descriptor.offset =
       offsetof(ModelShader::VertexData, position);
   pipeline_->vertex_descriptor.stride = sizeof(ModelShader::VertexData);
+  pipeline_->vertex_descriptor.index_type = IndexType::kUInt32;
 
   is_valid_ = true;
 }
@@ -145,7 +193,8 @@ void Model::RenderTo(Rasterizer& rasterizer) {
   sft::Uniforms uniforms;
   uniforms.buffer = *uniform_buffer;
   uniforms.images[0] = texture_;
-  rasterizer.Draw(pipeline_, *vertex_buffer_, uniforms, vertex_count_);
+  rasterizer.Draw(pipeline_, *vertex_buffer_, *index_buffer_, uniforms,
+                  index_count_);
 }
 
 void Model::SetScale(ScalarF scale) {
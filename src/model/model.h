@@ -43,8 +43,9 @@ class Model {
   std::shared_ptr<ModelShader> model_shader_;
   std::shared_ptr<Pipeline> pipeline_;
   std::shared_ptr<Buffer> vertex_buffer_;
+  std::shared_ptr<Buffer> index_buffer_;
   std::shared_ptr<Image> texture_;
-  size_t vertex_count_ = 0u;
+  size_t index_count_ = 0u;
   ScalarF scale_ = 1.0f;
   ScalarF rotation_ = 0.0f;
   glm::vec3 light_direction_ = {0.0, 0.0, 1.0};
@@ -54,6 +54,20 @@ class ModelShader final : public Shader {
     return color;
   }
 
+  void ProcessFragmentBatch(FragmentBatch& inv) const override {
+    const auto normal = VARYING_LOAD(normal);
+    const auto texture_coord = VARYING_LOAD(texture_coord);
+    const auto light = glm::normalize(glm::vec4{UNIFORM(light), 1.0});
+    const auto& image = inv.LoadImage(0u);
+    for (size_t i = 0; i < inv.GetCount(); i++) {
+      const auto intensity =
+          glm::dot(light, glm::normalize(glm::vec4{normal[i], 1.0}));
+      auto color = image.Sample(texture_coord[i]);
+      color *= glm::vec4{intensity, intensity, intensity, 1.0};
+      inv.StoreColor(i, color);
+    }
+  }
+
  private:
   SFT_DISALLOW_COPY_AND_ASSIGN(ModelShader);
 };
@@ -47,7 +47,7 @@ bool ImGui_ImplSFT_Init(SDL_Window* window, SDL_Renderer* renderer) {
   io.Fonts->SetTexID(font_atlas.get());
 
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.offset =
       offsetof(ImGuiShader::VertexData, vertex_position);
   pipeline->vertex_descriptor.stride = sizeof(ImGuiShader::VertexData);
@@ -50,6 +50,16 @@ class ImGuiShader final : public Shader {
     return color * texture_color;
   }
 
+  void ProcessFragmentBatch(FragmentBatch& inv) const override {
+    const auto texture_coordinates = VARYING_LOAD(texture_coordinates);
+    const auto vertex_color = VARYING_LOAD(vertex_color);
+    const auto& image = inv.LoadImage(0u);
+    for (size_t i = 0; i < inv.GetCount(); i++) {
+      const glm::vec4 texture_color = image.Sample(texture_coordinates[i]);
+      inv.StoreColor(i, vertex_color[i] * texture_color);
+    }
+  }
+
  private:
   SFT_DISALLOW_COPY_AND_ASSIGN(ImGuiShader);
 };
@@ -102,6 +102,7 @@ Playground::~Playground() {
   if (sdl_renderer_) {
     ::SDL_DestroyRenderer(sdl_renderer_);
   }
+  rasterizer_->Wait();
   scheduler_->unbind();
 }
 
@@ -143,17 +144,27 @@ static void DisplayMetrics(const RasterizerMetrics& m) {
               m.primitives_processed * 100.f / m.primitive_count);
   ImGui::Text("Back Faces Culled: %zu (%.0f%%)", m.face_culling,
               m.face_culling * 100.f / m.primitive_count);
+  ImGui::Text("Clip Culled: %zu (%.0f%%)", m.clip_culling,
+              m.clip_culling * 100.f / m.primitive_count);
+  ImGui::Text("Clipped: %zu (%.0f%%)", m.clipped_primitives,
+              m.clipped_primitives * 100.f / m.primitive_count);
   ImGui::Text("Empty Primitive: %zu (%.0f%%)", m.empty_primitive,
               m.empty_primitive * 100.f / m.primitive_count);
   ImGui::Text("Scissor Culled: %zu (%.0f%%)", m.scissor_culling,
               m.scissor_culling * 100.f / m.primitive_count);
   ImGui::Text("Sample Point Culled: %zu (%.0f%%)", m.sample_point_culling,
               m.sample_point_culling * 100.f / m.primitive_count);
+  ImGui::Text("Coarse Blocks Rejected: %zu", m.coarse_blocks_rejected);
+  ImGui::Text("Coarse Blocks Accepted: %zu", m.coarse_blocks_accepted);
+  ImGui::Text("Hi-Z Culled Primitives: %zu", m.hi_z_culled_primitives);
+  ImGui::Text("Hi-Z Culled Blocks: %zu", m.hi_z_culled_blocks);
   ImGui::Text("Early Fragment Checks Tripped: %zu", m.early_fragment_test);
   ImGui::Text("Vertex Invocations: %zu", m.vertex_invocations);
+  ImGui::Text("Vertex Cache Hits: %zu", m.vertex_cache_hits);
   ImGui::Text(
       "Fragment Invocations: %zu (%.2fx screen)", m.fragment_invocations,
       static_cast<ScalarF>(m.fragment_invocations) / (m.area.x * m.area.y));
+  ImGui::Text("Discarded Fragments: %zu", m.discarded_fragments);
 
   ImGui::End();
 }
@@ -170,10 +181,16 @@ bool Playground::OnRender() {
 
   rasterizer_->ResetMetrics();
 
+  //----------------------------------------------------------------------------
+  // The draws of this frame are recorded while the previous one is shaded. It
+  // is presented once done and this one is submitted right after.
+  //----------------------------------------------------------------------------
   if (!Update()) {
     return false;
   }
 
+  rasterizer_->Wait();
+
   DisplayMetrics(rasterizer_->GetMetrics());
   rasterizer_->ResetMetrics();
 
@@ -181,19 +198,21 @@ bool Playground::OnRender() {
 
   ImGui_ImplSFT_RenderDrawData(rasterizer_.get(), ImGui::GetDrawData());
 
-  rasterizer_->Finish();
-
   const auto size = rasterizer_->GetSize();
 
-  auto& pass = rasterizer_->GetRenderPassAttachments();
+  // Only the first color attachment is presented.
+  const auto& color = rasterizer_->GetRenderPassAttachments().colors.front();
+  // Multisampled color attachments are resolved a tile at a time as the frame
+  // is shaded.
   std::shared_ptr<Texture<Color>> texture;
-  if (pass.color.texture->GetSampleCount() == SampleCount::kOne) {
-    texture = pass.color.texture;
+  if (color.GetSampleCount() == SampleCount::kOne) {
+    texture = color.GetTexture<Color>();
   } else {
-    if (!pass.color.texture->Resolve(*pass.color.resolve)) {
-      return false;
-    }
-    texture = pass.color.resolve;
+    texture = color.GetResolveTexture<Color>();
+  }
+  if (!texture) {
+    // Only 8-bit RGBA colors can be presented.
+    return false;
   }
 
   last_update_duration_ = Clock::now() - update_start;
@@ -224,6 +243,8 @@ bool Playground::OnRender() {
   }
 
   ::SDL_RenderPresent(sdl_renderer_);
+
+  rasterizer_->Submit();
   return true;
 }
 
@@ -0,0 +1,652 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "blend.h"
+#include "buffer.h"
+#include "color_shader.h"
+#include "gbuffer_shader.h"
+#include "invocation.h"
+#include "marl/scheduler.h"
+#include "pipeline.h"
+#include "pixel_format.h"
+#include "rasterizer.h"
+#include "texture.h"
+
+namespace sft {
+namespace testing {
+
+//------------------------------------------------------------------------------
+/// @brief      Tests that render off-screen and check the contents of the
+///             attachments. Unlike playground tests, they need no window.
+///
+class RasterizerPixelTest : public ::testing::Test {
+ public:
+  RasterizerPixelTest() : scheduler_(marl::Scheduler::Config::allCores()) {
+    scheduler_.bind();
+  }
+
+  ~RasterizerPixelTest() { scheduler_.unbind(); }
+
+ private:
+  marl::Scheduler scheduler_;
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(RasterizerPixelTest);
+};
+
+//------------------------------------------------------------------------------
+/// @brief      Writes the same per-vertex color interpolated flat, linearly in
+///             screen-space and perspective-correctly into the first three
+///             color attachments.
+///
+class InterpolationShader final : public Shader {
+ public:
+  struct VertexData {
+    glm::vec4 position;
+    glm::vec4 color;
+  };
+
+  struct Varyings {
+    glm::vec4 flat_color;
+    glm::vec4 screen_color;
+    glm::vec4 perspective_color;
+  };
+
+  InterpolationShader() = default;
+
+  size_t GetVaryingsSize() const override { return sizeof(Varyings); }
+
+  std::vector<VaryingDescriptor> GetVaryingDescriptors() const override {
+    return {
+        VARYING_INTERPOLATION(flat_color, kFlat),
+        VARYING_INTERPOLATION(screen_color, kNoPerspective),
+    };
+  }
+
+  glm::vec4 ProcessVertex(const VertexInvocation& inv) const override {
+    FORWARD(color, flat_color);
+    FORWARD(color, screen_color);
+    FORWARD(color, perspective_color);
+    return VTX(position);
+  }
+
+  glm::vec4 ProcessFragment(const FragmentInvocation& inv) const override {
+    return VARYING_LOAD(flat_color);
+  }
+
+  void ProcessFragmentBatch(FragmentBatch& batch) const override {
+    const auto flat_color =
+        batch.LoadVarying<glm::vec4>(offsetof(Varyings, flat_color));
+    const auto screen_color =
+        batch.LoadVarying<glm::vec4>(offsetof(Varyings, screen_color));
+    const auto perspective_color =
+        batch.LoadVarying<glm::vec4>(offsetof(Varyings, perspective_color));
+    for (size_t i = 0; i < batch.GetCount(); i++) {
+      batch.StoreColor(i, flat_color[i], 0);
+      batch.StoreColor(i, screen_color[i], 1);
+      batch.StoreColor(i, perspective_color[i], 2);
+    }
+  }
+
+ private:
+  SFT_DISALLOW_COPY_AND_ASSIGN(InterpolationShader);
+};
+
+template <class Pixel = Color>
+static Pixel ReadColor(const ColorPassAttachment& attachment, glm::ivec2 pos) {
+  const auto texture = attachment.GetSampleCount() == SampleCount::kOne
+                           ? attachment.GetTexture<Pixel>()
+                           : attachment.GetResolveTexture<Pixel>();
+  SFT_ASSERT(texture);
+  return *texture->Get(pos, 0);
+}
+
+static constexpr glm::ivec2 kSize = {256, 256};
+static constexpr glm::ivec2 kCenter = kSize / 2;
+static constexpr glm::ivec2 kCorner = {4, 4};
+
+TEST_F(RasterizerPixelTest, SingleOutputShaderLeavesOtherAttachmentsAsIs) {
+  using VD = ColorShader::VertexData;
+  using Uniforms = ColorShader::Uniforms;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<ColorShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+  // Opaque and depth tested. So shading is deferred when the visibility
+  // buffer is enabled.
+  pipeline->depth_desc.depth_test_enabled = true;
+
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-0.5, -0.5, 0.5}},
+      VD{.position = {0.0, 0.5, 0.5}},
+      VD{.position = {0.5, -0.5, 0.5}},
+  });
+  auto uniform_buffer = buffer->Emplace(Uniforms{.color = kColorFirebrick});
+
+  for (auto sample_count : {SampleCount::kOne, SampleCount::kFour}) {
+    for (auto visibility_buffer : {false, true}) {
+      Rasterizer rasterizer(kSize, sample_count);
+      rasterizer.SetVisibilityBufferEnabled(visibility_buffer);
+      auto& pass = rasterizer.GetRenderPassAttachments();
+      ASSERT_TRUE(pass.SetColorAttachmentCount(2));
+      pass.colors[1].clear_color = kColorSkyBlue;
+      rasterizer.Clear(kColorBeige);
+      rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+      rasterizer.Finish();
+
+      const auto& colors = rasterizer.GetRenderPassAttachments().colors;
+      EXPECT_EQ(ReadColor(colors[0], kCenter).color, kColorFirebrick.color);
+      EXPECT_EQ(ReadColor(colors[0], kCorner).color, kColorBeige.color);
+      EXPECT_EQ(ReadColor(colors[1], kCenter).color, kColorSkyBlue.color);
+      EXPECT_EQ(ReadColor(colors[1], kCorner).color, kColorSkyBlue.color);
+    }
+  }
+}
+
+TEST_F(RasterizerPixelTest, CanChangeSampleCountAfterRecordingDraws) {
+  using VD = ColorShader::VertexData;
+  using Uniforms = ColorShader::Uniforms;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<ColorShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-0.5, -0.5, 0.5}},
+      VD{.position = {0.0, 0.5, 0.5}},
+      VD{.position = {0.5, -0.5, 0.5}},
+  });
+  auto uniform_buffer = buffer->Emplace(Uniforms{.color = kColorFirebrick});
+
+  const std::pair<SampleCount, SampleCount> changes[] = {
+      {SampleCount::kOne, SampleCount::kFour},
+      {SampleCount::kFour, SampleCount::kOne},
+      {SampleCount::kTwo, SampleCount::kSixteen},
+  };
+  for (const auto& [recorded, shaded] : changes) {
+    // Recorded with the sample count it is shaded with.
+    Rasterizer expected(kSize, shaded);
+    expected.Clear(kColorBeige);
+    expected.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+    expected.Finish();
+
+    Rasterizer rasterizer(kSize, recorded);
+    rasterizer.Clear(kColorBeige);
+    rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+    ASSERT_TRUE(rasterizer.ResizeSamples(shaded));
+    rasterizer.Finish();
+
+    const auto& expected_color =
+        expected.GetRenderPassAttachments().colors.front();
+    const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+    size_t mismatches = 0;
+    for (auto y = 0; y < kSize.y; y++) {
+      for (auto x = 0; x < kSize.x; x++) {
+        mismatches += ReadColor(color, {x, y}).color !=
+                      ReadColor(expected_color, {x, y}).color;
+      }
+    }
+    EXPECT_EQ(mismatches, 0u);
+  }
+}
+
+TEST_F(RasterizerPixelTest, CanWriteMultipleColorAttachments) {
+  using VD = GBufferShader::VertexData;
+  using Uniforms = GBufferShader::Uniforms;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<GBufferShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+  pipeline->depth_desc.depth_test_enabled = true;
+
+  auto buffer = Buffer::Create();
+  // Covers the whole render target.
+  auto back_vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-1.0, -1.0, 0.5}, .normal = {1.0, 0.0, 0.0}},
+      VD{.position = {-1.0, 3.0, 0.5}, .normal = {1.0, 0.0, 0.0}},
+      VD{.position = {3.0, -1.0, 0.5}, .normal = {1.0, 0.0, 0.0}},
+  });
+  // Covers the center but not the corners.
+  auto front_vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-0.5, -0.5, 0.25}, .normal = {0.0, 0.0, 1.0}},
+      VD{.position = {0.0, 0.5, 0.25}, .normal = {0.0, 0.0, 1.0}},
+      VD{.position = {0.5, -0.5, 0.25}, .normal = {0.0, 0.0, 1.0}},
+  });
+  auto back_uniform_buffer = buffer->Emplace(Uniforms{
+      .albedo = kColorFuchsia,
+      .id = 1,
+  });
+  auto front_uniform_buffer = buffer->Emplace(Uniforms{
+      .albedo = kColorSkyBlue,
+      .id = 0x01020304,
+  });
+
+  for (auto sample_count : {SampleCount::kOne, SampleCount::kFour}) {
+    for (auto visibility_buffer : {false, true}) {
+      Rasterizer rasterizer(kSize, sample_count);
+      rasterizer.SetVisibilityBufferEnabled(visibility_buffer);
+      auto& pass = rasterizer.GetRenderPassAttachments();
+      ASSERT_TRUE(pass.SetColorAttachmentCount(3));
+      rasterizer.Clear(kColorBeige);
+      // Drawn back to front so that both are shaded without a visibility
+      // buffer.
+      rasterizer.Draw(pipeline, back_vertex_buffer, back_uniform_buffer, 3u);
+      rasterizer.Draw(pipeline, front_vertex_buffer, front_uniform_buffer,
+                      3u);
+      rasterizer.Finish();
+
+      const auto& colors = rasterizer.GetRenderPassAttachments().colors;
+      const auto& albedo = colors[GBufferShader::kAlbedoLocation];
+      const auto& normal = colors[GBufferShader::kNormalLocation];
+      const auto& ids = colors[GBufferShader::kIDLocation];
+      EXPECT_EQ(ReadColor(albedo, kCenter).color, kColorSkyBlue.color);
+      EXPECT_EQ(ReadColor(albedo, kCorner).color, kColorFuchsia.color);
+      EXPECT_EQ(ReadColor(normal, kCenter).color,
+                Color(glm::vec4{0.5, 0.5, 1.0, 1.0}).color);
+      EXPECT_EQ(ReadColor(normal, kCorner).color,
+                Color(glm::vec4{1.0, 0.5, 0.5, 1.0}).color);
+      EXPECT_EQ(GBufferShader::DecodeID(ReadColor(ids, kCenter)), 0x01020304u);
+      EXPECT_EQ(GBufferShader::DecodeID(ReadColor(ids, kCorner)), 1u);
+    }
+  }
+}
+
+TEST_F(RasterizerPixelTest, ShadesWithThePipelineAsItWasWhenRecorded) {
+  using VD = ColorShader::VertexData;
+  using Uniforms = ColorShader::Uniforms;
+
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-0.5, -0.5, 0.5}},
+      VD{.position = {0.0, 0.5, 0.5}},
+      VD{.position = {0.5, -0.5, 0.5}},
+  });
+  auto uniform_buffer =
+      buffer->Emplace(Uniforms{.color = kColorFirebrick.WithAlpha(128)});
+  const auto source_over = BlendDescriptorForMode(BlendMode::kSourceOver);
+  const auto destination_over =
+      BlendDescriptorForMode(BlendMode::kDestinationOver);
+
+  const auto make_pipeline = [](const BlendDescriptor& blend) {
+    auto pipeline = std::make_shared<Pipeline>();
+    pipeline->shader = std::make_shared<ColorShader>();
+    pipeline->vertex_descriptor.offset = offsetof(VD, position);
+    pipeline->vertex_descriptor.stride = sizeof(VD);
+    pipeline->color_descs[0].blend = blend;
+    return pipeline;
+  };
+  const auto draw_frame = [&](const std::shared_ptr<Pipeline>& pipeline) {
+    Rasterizer rasterizer(kSize, SampleCount::kOne);
+    rasterizer.Clear(kColorBeige);
+    rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+    rasterizer.Finish();
+    return ReadColor(rasterizer.GetRenderPassAttachments().colors.front(),
+                     kCenter);
+  };
+  const auto expected_source_over = draw_frame(make_pipeline(source_over));
+  const auto expected_destination_over =
+      draw_frame(make_pipeline(destination_over));
+  ASSERT_NE(expected_source_over.color, expected_destination_over.color);
+
+  // Update the pipeline for the next frame once the draws of each are
+  // recorded. Shading may happen any time until the frame is waited on.
+  auto pipeline = make_pipeline(source_over);
+  Rasterizer rasterizer(kSize, SampleCount::kOne);
+  const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+  rasterizer.Clear(kColorBeige);
+  rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+  pipeline->color_descs[0].blend = destination_over;
+  rasterizer.Submit();
+  pipeline->color_descs[0].blend = {};
+  rasterizer.Wait();
+  EXPECT_EQ(ReadColor(color, kCenter).color, expected_source_over.color);
+
+  pipeline->color_descs[0].blend = destination_over;
+  rasterizer.Clear(kColorBeige);
+  rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+  pipeline->color_descs[0].blend = source_over;
+  rasterizer.Submit();
+  pipeline->color_descs[0].blend = {};
+  rasterizer.Wait();
+  EXPECT_EQ(ReadColor(color, kCenter).color, expected_destination_over.color);
+}
+
+TEST_F(RasterizerPixelTest, CanInterpolateVaryingsWithQualifiers) {
+  using VD = InterpolationShader::VertexData;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<InterpolationShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+
+  // On the pixel grid so that snapping them to the sub-pixel grid is exact.
+  // Each at a different depth so that perspective-correct interpolation
+  // differs from screen-space interpolation.
+  const std::array<glm::vec2, 3> pixels = {
+      glm::vec2{16, 16},
+      glm::vec2{128, 240},
+      glm::vec2{240, 16},
+  };
+  const std::array<ScalarF, 3> w = {1.0, 2.0, 4.0};
+  const std::array<glm::vec4, 3> colors = {
+      glm::vec4{1.0, 0.0, 0.0, 1.0},
+      glm::vec4{0.0, 1.0, 0.0, 1.0},
+      glm::vec4{0.0, 0.0, 1.0, 1.0},
+  };
+  std::vector<VD> vertices;
+  for (size_t i = 0; i < 3; i++) {
+    const auto ndc = pixels[i] / (glm::vec2{kSize} / 2.0f) - 1.0f;
+    vertices.push_back(VD{
+        .position = glm::vec4{ndc, 0.5, 1.0} * w[i],
+        .color = colors[i],
+    });
+  }
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(vertices);
+
+  Rasterizer rasterizer(kSize, SampleCount::kOne);
+  ASSERT_TRUE(rasterizer.SetColorAttachmentCount(3));
+  rasterizer.Clear(kColorBeige);
+  rasterizer.Draw(pipeline, vertex_buffer, {}, 3u);
+  rasterizer.Finish();
+  const auto& attachments = rasterizer.GetRenderPassAttachments().colors;
+
+  const auto expect_near = [](Color actual, glm::vec4 expected) {
+    const Color expected_color = expected;
+    EXPECT_NEAR(actual.red, expected_color.red, 1);
+    EXPECT_NEAR(actual.green, expected_color.green, 1);
+    EXPECT_NEAR(actual.blue, expected_color.blue, 1);
+    EXPECT_NEAR(actual.alpha, expected_color.alpha, 1);
+  };
+  const auto area = [](glm::vec2 a, glm::vec2 b, glm::vec2 c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  };
+  const auto total_area = area(pixels[0], pixels[1], pixels[2]);
+  size_t pixels_checked = 0;
+  for (auto y = 0; y < kSize.y; y += 8) {
+    for (auto x = 0; x < kSize.x; x += 8) {
+      const auto center = glm::vec2{x, y} + 0.5f;
+      const auto b = glm::vec3{area(center, pixels[1], pixels[2]),
+                               area(pixels[0], center, pixels[2]),
+                               area(pixels[0], pixels[1], center)} /
+                     total_area;
+      // Away from the edges which are shaded by either primitive.
+      if (std::min({b.x, b.y, b.z}) < 0.01f) {
+        continue;
+      }
+      const auto p = b / glm::vec3{w[0], w[1], w[2]};
+      const auto perspective_b = p / (p.x + p.y + p.z);
+      expect_near(ReadColor(attachments[0], {x, y}), colors[0]);
+      expect_near(ReadColor(attachments[1], {x, y}),
+                  b.x * colors[0] + b.y * colors[1] + b.z * colors[2]);
+      expect_near(ReadColor(attachments[2], {x, y}),
+                  perspective_b.x * colors[0] + perspective_b.y * colors[1] +
+                      perspective_b.z * colors[2]);
+      pixels_checked++;
+    }
+  }
+  EXPECT_GT(pixels_checked, 100u);
+}
+
+TEST_F(RasterizerPixelTest, ClipsPrimitivesAgainstTheNearPlane) {
+  using VD = ColorShader::VertexData;
+  using Uniforms = ColorShader::Uniforms;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<ColorShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+
+  // The bottom-left corner is beyond the near plane. The clipped edges run
+  // halfway between it and the other vertices.
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-1.0, -1.0, -3.0}},
+      VD{.position = {0.0, 1.0, 1.0}},
+      VD{.position = {1.0, -1.0, 1.0}},
+  });
+  auto uniform_buffer = buffer->Emplace(Uniforms{.color = kColorFirebrick});
+
+  Rasterizer rasterizer(kSize, SampleCount::kOne);
+  rasterizer.Clear(kColorBeige);
+  rasterizer.Draw(pipeline, vertex_buffer, uniform_buffer, 3u);
+  rasterizer.Finish();
+
+  const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+  EXPECT_EQ(ReadColor(color, kCorner).color, kColorBeige.color);
+  EXPECT_EQ(ReadColor(color, kCenter).color, kColorFirebrick.color);
+  EXPECT_EQ(ReadColor(color, {kSize.x - kCorner.x, kCorner.y}).color,
+            kColorFirebrick.color);
+}
+
+TEST_F(RasterizerPixelTest, ClipsPrimitivesAgainstTheNearPlaneOfTheDepthRange) {
+  using VD = InterpolationShader::VertexData;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<InterpolationShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+
+  // The bottom-left corner is nearer to the eye than the near plane but
+  // farther than half of it. Its depth is in [-1, 0) after the divide. The
+  // others are behind the near plane.
+  const auto projection =
+      glm::perspectiveLH_ZO(glm::radians(90.0f), 1.0f, 1.0f, 100.0f);
+  const glm::vec4 firebrick = kColorFirebrick;
+  std::vector<VD> vertices;
+  for (const auto& position : {glm::vec3{-0.75, -0.75, 0.75},
+                               glm::vec3{0.0, 2.0, 2.0},
+                               glm::vec3{2.0, -2.0, 2.0}}) {
+    vertices.push_back(VD{
+        .position = projection * glm::vec4{position, 1.0},
+        .color = firebrick,
+    });
+  }
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(vertices);
+
+  for (const auto depth_range :
+       {ClipDepthRange::kMinusOneToOne, ClipDepthRange::kZeroToOne}) {
+    pipeline->clip_depth_range = depth_range;
+    Rasterizer rasterizer(kSize, SampleCount::kOne);
+    rasterizer.Clear(kColorBeige);
+    rasterizer.Draw(pipeline, vertex_buffer, {}, 3u);
+    rasterizer.Finish();
+
+    const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+    EXPECT_EQ(ReadColor(color, kCorner).color,
+              depth_range == ClipDepthRange::kZeroToOne ? kColorBeige.color
+                                                    : kColorFirebrick.color);
+    EXPECT_EQ(ReadColor(color, kCenter).color, kColorFirebrick.color);
+  }
+}
+
+template <class Pixel, class Value>
+static void ExpectUnpackedValuesRoundTrip() {
+  using Traits = PixelFormatTraits<Pixel>;
+  for (uint32_t value = 0; value <= std::numeric_limits<Value>::max();
+       value++) {
+    Pixel pixel;
+    const auto packed = static_cast<Value>(value);
+    std::memcpy(&pixel, &packed, sizeof(Pixel));
+    const auto round_trip = Traits::Pack(Traits::Unpack(pixel));
+    ASSERT_EQ(std::memcmp(&pixel, &round_trip, sizeof(Pixel)), 0) << value;
+  }
+}
+
+TEST(PixelFormatTraitsTest, UnpackedValuesPackToThemselves) {
+  ExpectUnpackedValuesRoundTrip<ColorR5G6B5, uint16_t>();
+  ExpectUnpackedValuesRoundTrip<ColorR8G8, uint16_t>();
+  ExpectUnpackedValuesRoundTrip<ColorR8, uint8_t>();
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Clears and draws into an attachment in the pixel format, then
+///             blends into what was stored in a second frame. Checks the
+///             values read back against those packed from a frame shaded in
+///             8-bit RGBA from the unpacked values.
+///
+template <class Pixel>
+static void ExpectCanShadeIntoPixelFormat(SampleCount sample_count) {
+  SCOPED_TRACE(static_cast<int>(PixelFormatTraits<Pixel>::kFormat));
+  SCOPED_TRACE(sft::GetSampleCount(sample_count));
+  using Traits = PixelFormatTraits<Pixel>;
+  using VD = ColorShader::VertexData;
+  using Uniforms = ColorShader::Uniforms;
+
+  const auto make_pipeline = [](const BlendDescriptor& blend) {
+    auto pipeline = std::make_shared<Pipeline>();
+    pipeline->shader = std::make_shared<ColorShader>();
+    pipeline->vertex_descriptor.offset = offsetof(VD, position);
+    pipeline->vertex_descriptor.stride = sizeof(VD);
+    pipeline->color_descs[0].blend = blend;
+    return pipeline;
+  };
+  auto opaque = make_pipeline({});
+  // Reads the alpha of the destination, which is opaque once unpacked.
+  auto source_atop =
+      make_pipeline(BlendDescriptorForMode(BlendMode::kSourceAtop));
+
+  auto buffer = Buffer::Create();
+  auto vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-0.5, -0.5, 0.5}},
+      VD{.position = {0.0, 0.5, 0.5}},
+      VD{.position = {0.5, -0.5, 0.5}},
+  });
+  auto opaque_uniforms = buffer->Emplace(Uniforms{.color = kColorFirebrick});
+  auto translucent_uniforms =
+      buffer->Emplace(Uniforms{.color = kColorSkyBlue.WithAlpha(128)});
+  const auto expect_eq = [](Pixel actual, Color expected) {
+    EXPECT_EQ(Traits::Unpack(actual).color,
+              Traits::Unpack(Traits::Pack(expected)).color);
+  };
+
+  Rasterizer rasterizer(kSize, sample_count);
+  {
+    auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+    ASSERT_TRUE(color.SetPixelFormat(Traits::kFormat));
+    // The samples are loaded by the next frame.
+    color.store_action = StoreAction::kStoreAndMultisampleResolve;
+  }
+  rasterizer.Clear(kColorBeige);
+  rasterizer.Draw(opaque, vertex_buffer, opaque_uniforms, 3u);
+  rasterizer.Finish();
+  {
+    const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+    expect_eq(ReadColor<Pixel>(color, kCorner), kColorBeige);
+    expect_eq(ReadColor<Pixel>(color, kCenter), kColorFirebrick);
+  }
+
+  // Blend into the values loaded from the attachment.
+  rasterizer.Draw(source_atop, vertex_buffer, translucent_uniforms, 3u);
+  rasterizer.Finish();
+
+  // Channels the format has no room for are dropped. Alpha is opaque.
+  Rasterizer expected(kSize, sample_count);
+  expected.Clear(Traits::Unpack(Traits::Pack(kColorFirebrick)).WithAlpha(255));
+  expected.Draw(source_atop, vertex_buffer, translucent_uniforms, 3u);
+  expected.Finish();
+  const auto expected_color = ReadColor(
+      expected.GetRenderPassAttachments().colors.front(), kCenter);
+  ASSERT_NE(expected_color.color,
+            Traits::Unpack(Traits::Pack(kColorFirebrick)).color);
+  {
+    const auto& color = rasterizer.GetRenderPassAttachments().colors.front();
+    expect_eq(ReadColor<Pixel>(color, kCorner), kColorBeige);
+    expect_eq(ReadColor<Pixel>(color, kCenter), expected_color);
+  }
+}
+
+TEST_F(RasterizerPixelTest, CanShadeIntoCompactPixelFormats) {
+  for (auto sample_count : {SampleCount::kOne, SampleCount::kFour}) {
+    ExpectCanShadeIntoPixelFormat<ColorR5G6B5>(sample_count);
+    ExpectCanShadeIntoPixelFormat<ColorR8G8>(sample_count);
+    ExpectCanShadeIntoPixelFormat<ColorR8>(sample_count);
+  }
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Averages each channel of the samples on its own rounding halves
+///             up, which is what resolving the samples of a pixel must match.
+///
+template <size_t kSampleCount>
+static Color AverageSamples(const std::array<Color, kSampleCount>& samples) {
+  std::array<uint32_t, 4> sums = {};
+  for (const auto& sample : samples) {
+    sums[0] += sample.red;
+    sums[1] += sample.green;
+    sums[2] += sample.blue;
+    sums[3] += sample.alpha;
+  }
+  for (auto& sum : sums) {
+    sum = (sum + kSampleCount / 2) / kSampleCount;
+  }
+  return Color(sums[0], sums[1], sums[2], sums[3]);
+}
+
+template <size_t kSampleCount>
+static void ExpectResolvesToAverage(std::mt19937& generator) {
+  SCOPED_TRACE(kSampleCount);
+  std::vector<std::array<Color, kSampleCount>> cases;
+  // Every channel saturated so that any carry out of a channel would spill
+  // into the next.
+  cases.push_back({});
+  cases.back().fill(Color{0xFFFFFFFFu});
+  cases.push_back({});
+  cases.back().fill(Color{0u});
+  // Halfway between two values in every channel so that the rounding carries
+  // into the next bit. Saturated and empty channels are interleaved so that a
+  // carry out of either would show up in its neighbor.
+  for (const auto& [low, high] :
+       {std::pair{Color{0x00FE00FEu}, Color{0x00FF00FFu}},
+        std::pair{Color{0xFE00FE00u}, Color{0xFF00FF00u}},
+        std::pair{Color{0x00000000u}, Color{0x01010101u}},
+        std::pair{Color{0x7F7F7F7Fu}, Color{0x80808080u}}}) {
+    cases.push_back({});
+    for (size_t i = 0; i < kSampleCount; i++) {
+      cases.back()[i] = i % 2 == 0 ? low : high;
+    }
+  }
+  // All but one sample saturated.
+  cases.push_back({});
+  cases.back().fill(Color{0xFFFFFFFFu});
+  cases.back().back() = Color{0xFEFEFEFEu};
+  std::uniform_int_distribution<uint32_t> distribution;
+  for (size_t i = 0; i < 4096; i++) {
+    cases.push_back({});
+    for (auto& sample : cases.back()) {
+      sample = Color{distribution(generator)};
+    }
+  }
+  for (const auto& samples : cases) {
+    EXPECT_EQ(ResolveSamples<kSampleCount>(samples.data()).color,
+              AverageSamples<kSampleCount>(samples).color);
+  }
+}
+
+TEST(ResolveSamplesTest, MatchesAverageOfEachChannel) {
+  std::mt19937 generator(7);
+  ExpectResolvesToAverage<2u>(generator);
+  ExpectResolvesToAverage<4u>(generator);
+  ExpectResolvesToAverage<8u>(generator);
+  ExpectResolvesToAverage<16u>(generator);
+}
+
+}  // namespace testing
+}  // namespace sft
@@ -8,7 +8,9 @@
 #include "buffer.h"
 #include "canvas.h"
 #include "color_shader.h"
+#include "cutout_shader.h"
 #include "fixtures_location.h"
+#include "gbuffer_shader.h"
 #include "imgui.h"
 #include "model.h"
 #include "pipeline.h"
@@ -65,7 +67,7 @@ TEST_F(RasterizerTest, CanDrawTexturedImage) {
   auto image2 = Image::Create(SFT_ASSETS_LOCATION "boston.jpg");
   auto image3 = Image::Create(SFT_ASSETS_LOCATION "kalimba.jpg");
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
   application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
@@ -143,7 +145,7 @@ TEST_F(RasterizerTest, CanDrawWithIndexBuffer16Bit) {
   uniforms.images[0] = Image::Create(SFT_ASSETS_LOCATION "embarcadero.jpg");
   auto index_buffer = buffer->Emplace(std::vector<uint16_t>{0, 1, 2, 2, 3, 0});
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.index_type = IndexType::kUInt16;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
@@ -203,7 +205,7 @@ TEST_F(RasterizerTest, CanBlendWithDifferentModes) {
     ImGui::TextWrapped(
         "Compare outputs to "
         "https://www.w3.org/TR/compositing-1/#porterduffcompositingoperators");
-    pipeline->color_desc.blend =
+    pipeline->color_descs[0].blend =
         BlendDescriptorForMode(static_cast<BlendMode>(selected));
     rasterizer.Draw(pipeline, dst_vertex, index_buffer, dst_uniform, 6);
     rasterizer.Draw(pipeline, src_vertex, index_buffer, src_uniform, 6);
@@ -248,7 +250,7 @@ TEST_F(RasterizerTest, CanDrawWithIndexBuffer32Bit) {
   uniforms.buffer = uniform_buffer;
   uniforms.images[0] = Image::Create(SFT_ASSETS_LOCATION "airplane.jpg");
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.index_type = IndexType::kUInt32;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
@@ -293,7 +295,7 @@ TEST_F(RasterizerTest, CanCompareLinearAndNearestSampling) {
   auto image2 = Image::Create(SFT_ASSETS_LOCATION "airplane.jpg");
   image2->SetSampler({.min_mag_filter = Filter::kNearest});
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
   application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
@@ -366,7 +368,7 @@ TEST_F(RasterizerTest, CanWrapModeRepeatAndMirror) {
   uniforms.buffer = uniform_buffer;
   uniforms.images[0] = image1;
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
   application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
@@ -417,7 +419,7 @@ TEST_F(RasterizerTest, CanWrapModeClampAndRepeat) {
   uniforms.buffer = uniform_buffer;
   uniforms.images[0] = image1;
   pipeline->shader = shader;
-  pipeline->color_desc.blend.enabled = true;
+  pipeline->color_descs[0].blend.enabled = true;
   pipeline->vertex_descriptor.offset = offsetof(VD, position);
   pipeline->vertex_descriptor.stride = sizeof(VD);
   application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
@@ -446,6 +448,27 @@ TEST_F(RasterizerTest, CanDrawTeapot) {
   ASSERT_TRUE(Run(application));
 }
 
+TEST_F(RasterizerTest, CanDeferShadingWithVisibilityBuffer) {
+  Playground application;
+  Model model(SFT_ASSETS_LOCATION "teapot/teapot.obj",
+              SFT_ASSETS_LOCATION "teapot");
+  model.SetScale(0.075);
+  auto image = Image::Create(SFT_ASSETS_LOCATION "marble.jpg");
+  image->SetSampler({.min_mag_filter = Filter::kLinear});
+  model.SetTexture(image);
+  ASSERT_TRUE(model.IsValid());
+  application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
+    static bool visibility_buffer = true;
+    ImGui::Checkbox("Visibility Buffer", &visibility_buffer);
+    rasterizer.SetVisibilityBufferEnabled(visibility_buffer);
+    rasterizer.Clear(kColorGray);
+    model.SetRotation(application.GetTimeSinceLaunch().count() * 45);
+    model.RenderTo(rasterizer);
+    return true;
+  });
+  ASSERT_TRUE(Run(application));
+}
+
 TEST_F(RasterizerTest, CanMSAA) {
   Playground application({800, 600}, SampleCount::kFour);
   Model model(SFT_ASSETS_LOCATION "teapot/teapot.obj",
@@ -497,8 +520,7 @@ TEST_F(RasterizerTest, CanMSAA) {
     static int msaa_current = 2;
     ImGui::ListBox("MSAA Options", &msaa_current, msaa_items,
                    IM_ARRAYSIZE(msaa_items));
-    SFT_ASSERT(rasterizer.GetRenderPassAttachments().SetSampleCount(
-        to_sample_count(msaa_current)));
+    SFT_ASSERT(rasterizer.ResizeSamples(to_sample_count(msaa_current)));
     rasterizer.Clear(kColorGray);
     static ScalarF rotation = 48.132;
     static ScalarF scale = 0.088;
@@ -719,6 +741,118 @@ TEST_F(RasterizerTest, CanPerformDepthTest) {
   ASSERT_TRUE(Run(application));
 }
 
+TEST_F(RasterizerTest, CanDiscardFragments) {
+  Playground application;
+
+  using CutoutVD = CutoutShader::VertexData;
+  using CutoutUniforms = CutoutShader::Uniforms;
+  using ColorVD = ColorShader::VertexData;
+  using ColorUniforms = ColorShader::Uniforms;
+
+  auto cutout_pipeline = std::make_shared<Pipeline>();
+  cutout_pipeline->shader = std::make_shared<CutoutShader>();
+  cutout_pipeline->vertex_descriptor.offset = offsetof(CutoutVD, position);
+  cutout_pipeline->vertex_descriptor.stride = sizeof(CutoutVD);
+  cutout_pipeline->depth_desc.depth_test_enabled = true;
+
+  auto color_pipeline = std::make_shared<Pipeline>();
+  color_pipeline->shader = std::make_shared<ColorShader>();
+  color_pipeline->vertex_descriptor.offset = offsetof(ColorVD, position);
+  color_pipeline->vertex_descriptor.stride = sizeof(ColorVD);
+  color_pipeline->depth_desc.depth_test_enabled = true;
+
+  glm::vec3 p1 = {-0.7, 0.5, 0.0};
+  glm::vec3 p2 = {0.7, 0.5, 0.0};
+  glm::vec3 p3 = {0.7, -0.5, 0.0};
+  glm::vec3 p4 = {-0.7, -0.5, 0.0};
+
+  glm::vec2 tl = {0.0, 0.0};
+  glm::vec2 tr = {1.0, 0.0};
+  glm::vec2 br = {1.0, 1.0};
+  glm::vec2 bl = {0.0, 1.0};
+
+  auto buffer = Buffer::Create();
+  auto cutout_vertex_buffer = buffer->Emplace(std::vector<CutoutVD>{
+      {tl, p1},
+      {tr, p2},
+      {br, p3},
+      {br, p3},
+      {bl, p4},
+      {tl, p1},
+  });
+  // Behind the cutout. Only visible where the cutout discarded fragments.
+  auto color_vertex_buffer = buffer->Emplace(std::vector<ColorVD>{
+      ColorVD{.position = {-1.0, -1.0, 0.5}},
+      ColorVD{.position = {0.0, 1.0, 0.5}},
+      ColorVD{.position = {1.0, -1.0, 0.5}},
+  });
+  auto cutout_uniform_buffer = buffer->Emplace(CutoutUniforms{
+      .alpha_cutoff = 0.5,
+  });
+  auto color_uniform_buffer = buffer->Emplace(ColorUniforms{
+      .color = kColorFuchsia,
+  });
+
+  auto image = Image::Create(SFT_ASSETS_LOCATION "tile.png");
+  application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
+    rasterizer.Clear(kColorBeige);
+    sft::Uniforms cutout_uniforms;
+    cutout_uniforms.buffer = cutout_uniform_buffer;
+    cutout_uniforms.images[0] = image;
+    rasterizer.Draw(cutout_pipeline, cutout_vertex_buffer, cutout_uniforms,
+                    6u);
+    rasterizer.Draw(color_pipeline, color_vertex_buffer, color_uniform_buffer,
+                    3u);
+    return true;
+  });
+  ASSERT_TRUE(Run(application));
+}
+
+TEST_F(RasterizerTest, CanWriteMultipleColorAttachments) {
+  Playground application;
+
+  using VD = GBufferShader::VertexData;
+  using Uniforms = GBufferShader::Uniforms;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->shader = std::make_shared<GBufferShader>();
+  pipeline->vertex_descriptor.offset = offsetof(VD, position);
+  pipeline->vertex_descriptor.stride = sizeof(VD);
+  pipeline->depth_desc.depth_test_enabled = true;
+
+  auto buffer = Buffer::Create();
+  auto back_vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-1.0, -1.0, 0.5}, .normal = {-1.0, 0.0, 1.0}},
+      VD{.position = {0.0, 1.0, 0.5}, .normal = {0.0, 1.0, 1.0}},
+      VD{.position = {1.0, -1.0, 0.5}, .normal = {1.0, 0.0, 1.0}},
+  });
+  // In front of the other at the center of the render target.
+  auto front_vertex_buffer = buffer->Emplace(std::vector<VD>{
+      VD{.position = {-1.0, 1.0, 0.25}, .normal = {0.0, 0.0, 1.0}},
+      VD{.position = {1.0, 1.0, 0.25}, .normal = {0.0, 0.0, 1.0}},
+      VD{.position = {0.0, -1.0, 0.25}, .normal = {0.0, -1.0, 1.0}},
+  });
+  auto back_uniform_buffer = buffer->Emplace(Uniforms{
+      .albedo = kColorFuchsia,
+      .id = 1,
+  });
+  auto front_uniform_buffer = buffer->Emplace(Uniforms{
+      .albedo = kColorSkyBlue,
+      .id = 2,
+  });
+
+  application.SetRasterizerCallback([&](Rasterizer& rasterizer) -> bool {
+    // Only the albedo is presented. The others are checked by the pixel
+    // tests.
+    SFT_ASSERT(rasterizer.SetColorAttachmentCount(3));
+    rasterizer.Clear(kColorBeige);
+    rasterizer.Draw(pipeline, back_vertex_buffer, back_uniform_buffer, 3u);
+    rasterizer.Draw(pipeline, front_vertex_buffer, front_uniform_buffer, 3u);
+    return true;
+  });
+  ASSERT_TRUE(Run(application));
+}
+
 TEST_F(RasterizerTest, CanShowHUD) {
   Playground application;
   application.SetRasterizerCallback([](Rasterizer& rasterizer) -> bool {
@@ -118,6 +118,12 @@ T StencilOperationPerform(StencilOperation op,
   return current_value;
 }
 
+//------------------------------------------------------------------------------
+/// The most color attachments a render pass may have. Each is written from
+/// the same fragment invocation.
+///
+constexpr size_t kMaxColorAttachments = 4;
+
 struct ColorAttachmentDescriptor {
   BlendDescriptor blend;
 };
@@ -0,0 +1,75 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "clipper.h"
+
+namespace sft {
+
+Clipper::Clipper(const glm::vec2& viewport, ClipDepthRange depth_range) {
+  // Positions in the guard band are within its size of the viewport after the
+  // perspective divide and the viewport transform.
+  const auto guard_band = 1.0f + (2.0f * kGuardBandSize) / viewport;
+  switch (depth_range) {
+    case ClipDepthRange::kMinusOneToOne:
+      planes_[0] = {{0.0f, 0.0f, 1.0f, 1.0f}};
+      break;
+    case ClipDepthRange::kZeroToOne:
+      planes_[0] = {{0.0f, 0.0f, 1.0f, 0.0f}};
+      break;
+  }
+  planes_[1] = {{0.0f, 0.0f, 0.0f, 1.0f}, kNearClipW};
+  planes_[2] = {{1.0f, 0.0f, 0.0f, guard_band.x}};
+  planes_[3] = {{-1.0f, 0.0f, 0.0f, guard_band.x}};
+  planes_[4] = {{0.0f, 1.0f, 0.0f, guard_band.y}};
+  planes_[5] = {{0.0f, -1.0f, 0.0f, guard_band.y}};
+}
+
+ClippedPolygon Clipper::Clip(const std::array<glm::vec4, 3>& triangle,
+                             ClipCode planes) const {
+  ClippedPolygon polygon;
+  polygon.Add({triangle[0], {1.0f, 0.0f, 0.0f}});
+  polygon.Add({triangle[1], {0.0f, 1.0f, 0.0f}});
+  polygon.Add({triangle[2], {0.0f, 0.0f, 1.0f}});
+
+  // The near planes are first so that the guard band planes only ever see
+  // positions in front of the eye.
+  for (size_t i = 0; i < kClipPlaneCount; i++) {
+    if ((planes & (1 << i)) == 0) {
+      continue;
+    }
+    const auto& plane = planes_[i];
+    ClippedPolygon clipped;
+    for (size_t j = 0; j < polygon.count; j++) {
+      const auto& a = polygon.vertices[j];
+      const auto& b = polygon.vertices[(j + 1) % polygon.count];
+      const auto a_distance = plane.GetDistance(a.position);
+      const auto b_distance = plane.GetDistance(b.position);
+      const auto a_inside = a_distance >= 0.0f;
+      const auto b_inside = b_distance >= 0.0f;
+      if (a_inside) {
+        clipped.Add(a);
+      }
+      if (a_inside == b_inside) {
+        continue;
+      }
+      // Always interpolate from the inside vertex so that the edges shared by
+      // adjacent triangles are split at exactly the same position.
+      const auto& in = a_inside ? a : b;
+      const auto& out = a_inside ? b : a;
+      const auto in_distance = a_inside ? a_distance : b_distance;
+      const auto out_distance = a_inside ? b_distance : a_distance;
+      const auto t = in_distance / (in_distance - out_distance);
+      clipped.Add({glm::mix(in.position, out.position, t),
+                   glm::mix(in.weights, out.weights, t)});
+    }
+    polygon = clipped;
+    if (polygon.count < 3) {
+      return {};
+    }
+  }
+  return polygon;
+}
+
+}  // namespace sft
@@ -0,0 +1,112 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "edge_equation.h"
+#include "geometry.h"
+#include "macros.h"
+#include "pipeline.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// Besides the near plane, primitives are clipped so that no vertex has a
+/// clip-space w smaller than this. The near and guard band planes together
+/// only keep w from being negative. This keeps the perspective divide away
+/// from zero for the positions they allow on the eye itself.
+///
+constexpr ScalarF kNearClipW = 1e-5f;
+
+//------------------------------------------------------------------------------
+/// How far primitives may extend beyond the edges of the viewport (in pixels)
+/// before they are clipped. Primitives within the guard band are left to the
+/// scissor. Small enough that snapped positions never overflow the fixed point
+/// range of the edge equations.
+///
+constexpr ScalarF kGuardBandSize = kMaxFixedPointCoordinate / 2;
+
+//------------------------------------------------------------------------------
+/// A bit for each clip plane that a vertex is on the outside of.
+///
+using ClipCode = uint8_t;
+
+constexpr size_t kClipPlaneCount = 6;
+
+//------------------------------------------------------------------------------
+/// @brief      A plane in clip-space. Positions with a non-negative distance
+///             from it are inside.
+///
+struct ClipPlane {
+  glm::vec4 normal;
+  ScalarF offset = 0.0f;
+
+  constexpr ScalarF GetDistance(const glm::vec4& position) const {
+    return glm::dot(normal, position) - offset;
+  }
+};
+
+struct ClipVertex {
+  glm::vec4 position;
+  //----------------------------------------------------------------------------
+  /// The barycentric coordinates of the vertex in the triangle that was
+  /// clipped. Used to interpolate the varyings of the vertex.
+  ///
+  glm::vec3 weights;
+};
+
+//------------------------------------------------------------------------------
+/// @brief      The convex polygon left after clipping a triangle. Each plane
+///             adds at most one vertex.
+///
+struct ClippedPolygon {
+  static constexpr size_t kMaxVertices = 3 + kClipPlaneCount;
+
+  std::array<ClipVertex, kMaxVertices> vertices;
+  size_t count = 0;
+
+  void Add(const ClipVertex& vertex) { vertices[count++] = vertex; }
+};
+
+//------------------------------------------------------------------------------
+/// @brief      Clips triangles in homogeneous clip-space against the near
+///             plane and the guard band around the viewport.
+///
+class Clipper {
+ public:
+  Clipper(const glm::vec2& viewport, ClipDepthRange depth_range);
+
+  SFT_ALWAYS_INLINE ClipCode GetClipCode(const glm::vec4& position) const {
+    ClipCode code = 0;
+    for (size_t i = 0; i < kClipPlaneCount; i++) {
+      code |= static_cast<ClipCode>(planes_[i].GetDistance(position) < 0.0f)
+              << i;
+    }
+    return code;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Clip a triangle against some of the planes.
+  ///
+  /// @param[in]  triangle  The clip-space positions of the vertices.
+  /// @param[in]  planes    The planes to clip against. Usually the union of
+  ///                       the clip codes of the vertices.
+  ///
+  /// @return     The clipped polygon. Has fewer than three vertices if nothing
+  ///             is left.
+  ///
+  ClippedPolygon Clip(const std::array<glm::vec4, 3>& triangle,
+                      ClipCode planes) const;
+
+ private:
+  std::array<ClipPlane, kClipPlaneCount> planes_;
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(Clipper);
+};
+
+}  // namespace sft
@@ -0,0 +1,66 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "edge_equation.h"
+
+namespace sft {
+
+static bool IsRepresentable(const glm::vec2& p) {
+  return glm::abs(p.x) < kMaxFixedPointCoordinate &&
+         glm::abs(p.y) < kMaxFixedPointCoordinate;
+}
+
+std::optional<TriangleEdges> TriangleEdges::Make(const glm::vec2& p1,
+                                                 const glm::vec2& p2,
+                                                 const glm::vec2& p3) {
+  // This also rejects NaNs.
+  if (!IsRepresentable(p1) || !IsRepresentable(p2) || !IsRepresentable(p3)) {
+    return std::nullopt;
+  }
+
+  const auto a = ToFixedPoint(p1);
+  const auto b = ToFixedPoint(p2);
+  const auto c = ToFixedPoint(p3);
+
+  TriangleEdges result;
+  result.edges[0] = EdgeEquation{b, c};
+  result.edges[1] = EdgeEquation{c, a};
+  result.edges[2] = EdgeEquation{a, b};
+
+  // Twice the signed area of the triangle. Only triangles whose edge functions
+  // are positive on the inside cover any samples.
+  const auto area = result.edges[2].Evaluate(c);
+  if (area <= 0) {
+    return std::nullopt;
+  }
+
+  result.bias = {
+      result.edges[0].bias,
+      result.edges[1].bias,
+      result.edges[2].bias,
+  };
+  result.origin = a;
+  result.one_over_area = 1.0f / static_cast<ScalarF>(area);
+  return result;
+}
+
+PlaneEquation TriangleEdges::GetPlaneEquation(const glm::vec3& values) const {
+  // The value at any point is the sum of the vertex values weighted by the
+  // normalized edge functions opposite them. At the first vertex, only the
+  // first edge function is non-zero.
+  const auto scale = one_over_area * kSubPixelScale;
+  PlaneEquation plane;
+  plane.a = (values.x * edges[0].a + values.y * edges[1].a +  //
+             values.z * edges[2].a) *
+            scale;
+  plane.b = (values.x * edges[0].b + values.y * edges[1].b +  //
+             values.z * edges[2].b) *
+            scale;
+  plane.c = values.x;
+  plane.origin = glm::vec2{origin} / static_cast<ScalarF>(kSubPixelScale);
+  return plane;
+}
+
+}  // namespace sft
@@ -0,0 +1,157 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "geometry.h"
+#include "macros.h"
+
+namespace sft {
+
+using FixedPoint = int64_t;
+using FixedPoint2 = glm::vec<2, FixedPoint>;
+using FixedPoint3 = glm::vec<3, FixedPoint>;
+
+//------------------------------------------------------------------------------
+/// The number of fractional bits vertex positions are snapped to. Sample
+/// locations are all multiples of 1/16th of a pixel and so are exactly
+/// representable.
+///
+constexpr FixedPoint kSubPixelBits = 8;
+constexpr FixedPoint kSubPixelScale = FixedPoint{1} << kSubPixelBits;
+
+//------------------------------------------------------------------------------
+/// The largest magnitude of a snapped coordinate (in pixels). Keeps all edge
+/// function products comfortably within 64 bits.
+///
+constexpr ScalarF kMaxFixedPointCoordinate = 1 << 20;
+
+constexpr FixedPoint ToFixedPoint(ScalarF value) {
+  value *= kSubPixelScale;
+  return static_cast<FixedPoint>(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+constexpr FixedPoint2 ToFixedPoint(const glm::vec2& point) {
+  return {ToFixedPoint(point.x), ToFixedPoint(point.y)};
+}
+
+constexpr FixedPoint2 ToFixedPoint(const glm::ivec2& pixel) {
+  return FixedPoint2{pixel} * kSubPixelScale;
+}
+
+//------------------------------------------------------------------------------
+/// @brief      An edge function `E(p) = a * p.x + b * p.y + c` in fixed point
+///             sub-pixel coordinates. The function is positive for points on
+///             the inside of the edge.
+///
+struct EdgeEquation {
+  FixedPoint a = 0;
+  FixedPoint b = 0;
+  FixedPoint c = 0;
+  //----------------------------------------------------------------------------
+  /// Zero for top-left edges and -1 otherwise. Added to the value of the edge
+  /// function before the inside test so that points exactly on an edge are
+  /// owned by exactly one of the triangles sharing it.
+  ///
+  FixedPoint bias = 0;
+
+  constexpr EdgeEquation() = default;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Create the edge function for the edge going from `v0` to `v1`.
+  ///
+  constexpr EdgeEquation(const FixedPoint2& v0, const FixedPoint2& v1)
+      : a(v1.y - v0.y), b(v0.x - v1.x), c(v1.x * v0.y - v1.y * v0.x) {
+    // Top edges are flat and go right. Left edges are ones that go up.
+    // https://learn.microsoft.com/en-us/windows/win32/direct3d11/d3d10-graphics-programming-guide-rasterizer-stage-rules
+    const auto is_top = a == 0 && b < 0;
+    const auto is_left = a > 0;
+    bias = (is_top || is_left) ? 0 : -1;
+  }
+
+  constexpr FixedPoint Evaluate(const FixedPoint2& p) const {
+    return a * p.x + b * p.y + c;
+  }
+};
+
+//------------------------------------------------------------------------------
+/// @brief      A value that varies linearly in screen-space across a triangle.
+///             The value at pixel position `p` is
+///             `a * (p.x - origin.x) + b * (p.y - origin.y) + c`.
+///
+struct PlaneEquation {
+  ScalarF a = 0.0f;
+  ScalarF b = 0.0f;
+  ScalarF c = 0.0f;
+  glm::vec2 origin;
+
+  constexpr ScalarF Evaluate(const glm::vec2& p) const {
+    return a * (p.x - origin.x) + b * (p.y - origin.y) + c;
+  }
+};
+
+//------------------------------------------------------------------------------
+/// @brief      The edge equations of a triangle set up once and stepped
+///             incrementally across the pixels it covers.
+///
+///             The edge at index `i` is the one opposite vertex `i`. So the
+///             value of that edge function at a point is proportional to the
+///             barycentric weight of vertex `i` at that point.
+///
+struct TriangleEdges {
+  std::array<EdgeEquation, 3> edges;
+  FixedPoint3 bias;
+  FixedPoint2 origin;
+  ScalarF one_over_area = 0.0f;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Snap the screen-space positions of the triangle vertices and
+  ///             setup the edge equations.
+  ///
+  /// @return     The edges or `std::nullopt` if the triangle has no area, faces
+  ///             the other way, or cannot be represented in fixed point.
+  ///
+  static std::optional<TriangleEdges> Make(const glm::vec2& p1,
+                                           const glm::vec2& p2,
+                                           const glm::vec2& p3);
+
+  SFT_ALWAYS_INLINE FixedPoint3 Evaluate(const FixedPoint2& p) const {
+    return {edges[0].Evaluate(p), edges[1].Evaluate(p), edges[2].Evaluate(p)};
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      The change in the edge function values when moving by the
+  ///             given offset.
+  ///
+  SFT_ALWAYS_INLINE FixedPoint3 GetStep(const FixedPoint2& offset) const {
+    return {
+        edges[0].a * offset.x + edges[0].b * offset.y,  //
+        edges[1].a * offset.x + edges[1].b * offset.y,  //
+        edges[2].a * offset.x + edges[2].b * offset.y,  //
+    };
+  }
+
+  SFT_ALWAYS_INLINE bool IsInside(const FixedPoint3& values) const {
+    return (values.x + bias.x) >= 0 &&  //
+           (values.y + bias.y) >= 0 &&  //
+           (values.z + bias.z) >= 0;
+  }
+
+  SFT_ALWAYS_INLINE glm::vec3 GetBarycentricCoordinates(
+      const FixedPoint3& values) const {
+    return glm::vec3{values} * one_over_area;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Setup the plane equation of a value given at each vertex.
+  ///
+  PlaneEquation GetPlaneEquation(const glm::vec3& values) const;
+};
+
+}  // namespace sft
@@ -0,0 +1,83 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "hi_z_buffer.h"
+
+#include <limits>
+
+namespace sft {
+
+HiZBuffer::HiZBuffer(glm::ivec2 size) {
+  Resize(size);
+}
+
+HiZBuffer::~HiZBuffer() = default;
+
+void HiZBuffer::Resize(glm::ivec2 size) {
+  size_ = size;
+  blocks_size_ = (size + kHiZBlockSize - 1) / kHiZBlockSize;
+  blocks_.resize(blocks_size_.x * blocks_size_.y);
+  Invalidate();
+}
+
+void HiZBuffer::Clear(ScalarF depth) {
+  for (auto& block : blocks_) {
+    block.range = {depth, depth};
+    block.exact = true;
+  }
+}
+
+void HiZBuffer::Invalidate() {
+  for (auto& block : blocks_) {
+    block.range = {-std::numeric_limits<ScalarF>::infinity(),
+                   std::numeric_limits<ScalarF>::infinity()};
+    block.exact = false;
+  }
+}
+
+DepthRange HiZBuffer::GetConservativeRange(glm::ivec2 min,
+                                           glm::ivec2 max) const {
+  const auto min_block = min / kHiZBlockSize;
+  const auto max_block = (max + kHiZBlockSize - 1) / kHiZBlockSize;
+  DepthRange range = {std::numeric_limits<ScalarF>::infinity(),
+                      -std::numeric_limits<ScalarF>::infinity()};
+  for (auto y = min_block.y; y < max_block.y; y++) {
+    for (auto x = min_block.x; x < max_block.x; x++) {
+      range = range.Union(blocks_[blocks_size_.x * y + x].range);
+    }
+  }
+  return range;
+}
+
+const DepthRange& HiZBuffer::GetExactRange(glm::ivec2 pixel,
+                                           const TileBuffer<ScalarF>& depth) {
+  auto& block = blocks_[GetBlockIndex(pixel)];
+  if (!block.exact) {
+    RecomputeBlock((pixel / kHiZBlockSize) * kHiZBlockSize, block, depth);
+  }
+  return block.range;
+}
+
+void HiZBuffer::RecomputeBlock(glm::ivec2 block_origin,
+                               Block& block,
+                               const TileBuffer<ScalarF>& depth) const {
+  const auto max = glm::min(block_origin + kHiZBlockSize, size_);
+  const auto samples = GetSampleCount(depth.GetSampleCount());
+  auto min_value = std::numeric_limits<ScalarF>::infinity();
+  auto max_value = -std::numeric_limits<ScalarF>::infinity();
+  for (auto y = block_origin.y; y < max.y; y++) {
+    for (auto x = block_origin.x; x < max.x; x++) {
+      const auto* values = depth.Get({x, y}, 0);
+      for (size_t i = 0; i < samples; i++) {
+        min_value = std::min(min_value, values[i]);
+        max_value = std::max(max_value, values[i]);
+      }
+    }
+  }
+  block.range = {min_value, max_value};
+  block.exact = true;
+}
+
+}  // namespace sft
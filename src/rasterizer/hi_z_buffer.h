@@ -0,0 +1,153 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "attachment.h"
+#include "geometry.h"
+#include "macros.h"
+#include "tile_buffer.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// The size of the square blocks of pixels summarized by a single entry in the
+/// hierarchical depth buffer. Tiles are aligned to this size so that no two
+/// tiles ever update the same entry.
+///
+constexpr Scalar kHiZBlockSize = 8;
+
+//------------------------------------------------------------------------------
+/// Depth values are interpolated differently when testing ranges and samples.
+/// Ranges are widened by this amount so that rounding never rejects a sample
+/// that would have passed.
+///
+constexpr ScalarF kHiZTolerance = 1e-6f;
+
+struct DepthRange {
+  ScalarF min = 0.0f;
+  ScalarF max = 0.0f;
+
+  constexpr DepthRange Union(const DepthRange& other) const {
+    return {std::min(min, other.min), std::max(max, other.max)};
+  }
+};
+
+//------------------------------------------------------------------------------
+/// @brief      Check if all depth values in a range are guaranteed to fail the
+///             compare function against all values in another.
+///
+/// @param[in]  compare  The depth compare function.
+/// @param[in]  values   The range of the new depth values.
+/// @param[in]  current  The range of the depth values in the depth buffer.
+///
+constexpr bool DepthRangeFails(CompareFunction compare,
+                               const DepthRange& values,
+                               const DepthRange& current) {
+  switch (compare) {
+    case CompareFunction::kNever:
+      return true;
+    case CompareFunction::kAlways:
+    case CompareFunction::kNotEqual:
+      return false;
+    case CompareFunction::kLess:
+      return values.min >= current.max;
+    case CompareFunction::kLessEqual:
+      return values.min > current.max;
+    case CompareFunction::kGreater:
+      return values.max <= current.min;
+    case CompareFunction::kGreaterEqual:
+      return values.max < current.min;
+    case CompareFunction::kEqual:
+      return values.max < current.min || values.min > current.max;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+/// @brief      A coarse summary of the minimum and maximum depth of each block
+///             of a depth texture.
+///
+///             Entries are widened cheaply as depth is written and marked as
+///             inexact. An inexact entry is recomputed from the depth texture
+///             the next time its exact range is needed.
+///
+class HiZBuffer {
+ public:
+  explicit HiZBuffer(glm::ivec2 size);
+
+  ~HiZBuffer();
+
+  void Resize(glm::ivec2 size);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Set the range of all blocks to a single depth value. Used
+  ///             when the depth texture is cleared.
+  ///
+  void Clear(ScalarF depth);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Mark the ranges of all blocks as unknown. Used when the depth
+  ///             texture is modified without going through the Hi-Z buffer.
+  ///
+  void Invalidate();
+
+  //----------------------------------------------------------------------------
+  /// @brief      Widen the range of the block containing the pixel to include
+  ///             new depth values written to it.
+  ///
+  void Update(glm::ivec2 pixel, const DepthRange& written) {
+    auto& block = blocks_[GetBlockIndex(pixel)];
+    block.range = block.range.Union(written);
+    block.exact = false;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get a range that contains the depth values of the block
+  ///             containing the pixel. Cheap but may be wider than necessary.
+  ///
+  const DepthRange& GetConservativeRange(glm::ivec2 pixel) const {
+    return blocks_[GetBlockIndex(pixel)].range;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get a range that contains the depth values of all blocks that
+  ///             contain pixels in the half-open range from min to max.
+  ///
+  DepthRange GetConservativeRange(glm::ivec2 min, glm::ivec2 max) const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the exact range of the depth values of the block
+  ///             containing the pixel. The range is recomputed from the depth
+  ///             values in the tile if writes have widened it.
+  ///
+  const DepthRange& GetExactRange(glm::ivec2 pixel,
+                                  const TileBuffer<ScalarF>& depth);
+
+ private:
+  struct Block {
+    DepthRange range;
+    bool exact = false;
+  };
+
+  glm::ivec2 size_;
+  glm::ivec2 blocks_size_;
+  std::vector<Block> blocks_;
+
+  size_t GetBlockIndex(glm::ivec2 pixel) const {
+    const auto block = pixel / kHiZBlockSize;
+    return blocks_size_.x * block.y + block.x;
+  }
+
+  void RecomputeBlock(glm::ivec2 block_origin,
+                      Block& block,
+                      const TileBuffer<ScalarF>& depth) const;
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(HiZBuffer);
+};
+
+}  // namespace sft
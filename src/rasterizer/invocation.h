@@ -5,8 +5,11 @@
 
 #pragma once
 
+#include <array>
+
 #include "geometry.h"
 #include "macros.h"
+#include "pixel_block.h"
 #include "rasterizer.h"
 #include "tiler.h"
 
@@ -14,6 +17,7 @@ namespace sft {
 
 class Rasterizer;
 struct VertexResources;
+struct FragmentBatch;
 
 struct VertexInvocation {
   template <class T>
@@ -49,9 +53,10 @@ struct VertexInvocation {
 struct FragmentInvocation {
   template <class T>
   T LoadVarying(size_t offset) const {
-    return frag_resources.LoadVarying<T>(barycentric_coordinates,  //
-                                         offset                    //
-    );
+    return frag_resources.LoadVarying<T>(
+        frag_resources.IsPerspectiveCorrect(offset) ? perspective_coordinates
+                                                    : barycentric_coordinates,
+        offset);
   }
 
   template <class T>
@@ -63,16 +68,149 @@ struct FragmentInvocation {
     return frag_resources.LoadImage(location);
   }
 
+  //----------------------------------------------------------------------------
+  /// @brief      Kill the fragment. The color returned by the shader is ignored
+  ///             and the fragment leaves no depth or stencil values behind.
+  ///             Shaders that call this must return true from
+  ///             `Shader::MayDiscard`.
+  ///
+  void Discard() const { discarded = true; }
+
+  bool IsDiscarded() const { return discarded; }
+
  private:
   friend Rasterizer;
+  friend FragmentBatch;
 
   glm::vec3 barycentric_coordinates;
+  glm::vec3 perspective_coordinates;
   const FragmentResources& frag_resources;
+  mutable bool discarded = false;
 
   FragmentInvocation(glm::vec3 p_barycentric_coordinates,
+                     glm::vec3 p_perspective_coordinates,
                      const FragmentResources& p_resources)
       : barycentric_coordinates(p_barycentric_coordinates),
+        perspective_coordinates(p_perspective_coordinates),
         frag_resources(p_resources) {}
 };
 
+//------------------------------------------------------------------------------
+/// @brief      The plane equation of a varying. Loaded once and evaluated for
+///             each fragment in a batch.
+///
+template <class T>
+struct VaryingBatch {
+  std::array<T, 3> plane;
+  const std::array<Lanes<ScalarF>, 3>& barycentric_coordinates;
+
+  T operator[](size_t index) const {
+    return plane[0] + barycentric_coordinates[1][index] * plane[1] +
+           barycentric_coordinates[2][index] * plane[2];
+  }
+};
+
+//------------------------------------------------------------------------------
+/// @brief      Fragments of the same primitive in a pixel block that are
+///             shaded together. Barycentric coordinates are stored as a
+///             structure of arrays so shaders can process all fragments in a
+///             tight loop.
+///
+struct FragmentBatch {
+  size_t GetCount() const { return count; }
+
+  template <class T>
+  VaryingBatch<T> LoadVarying(size_t offset) const {
+    return {frag_resources.LoadVaryingPlane<T>(offset),
+            frag_resources.IsPerspectiveCorrect(offset)
+                ? perspective_coordinates
+                : barycentric_coordinates};
+  }
+
+  template <class T>
+  T LoadUniform(size_t struct_offset) const {
+    return frag_resources.resources->LoadUniform<T>(struct_offset);
+  }
+
+  const Image& LoadImage(size_t location) const {
+    return frag_resources.LoadImage(location);
+  }
+
+  glm::vec3 GetBarycentricCoordinates(size_t index) const {
+    return {
+        barycentric_coordinates[0][index],
+        barycentric_coordinates[1][index],
+        barycentric_coordinates[2][index],
+    };
+  }
+
+  glm::vec3 GetPerspectiveCoordinates(size_t index) const {
+    return {
+        perspective_coordinates[0][index],
+        perspective_coordinates[1][index],
+        perspective_coordinates[2][index],
+    };
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the invocation of a single fragment in the batch. Used to
+  ///             fallback to shading fragments one at a time.
+  ///
+  FragmentInvocation GetInvocation(size_t index) const {
+    return {GetBarycentricCoordinates(index),
+            GetPerspectiveCoordinates(index), frag_resources};
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Store the color of a fragment in the batch for the color
+  ///             attachment at the location. A shader writing a location must
+  ///             store a color for every fragment in the batch. Attachments at
+  ///             locations no color is stored for are left as they are.
+  ///
+  void StoreColor(size_t index, const glm::vec4& color, size_t location = 0) {
+    colors[location][index] = color;
+    colors_stored |= (1u << location);
+  }
+
+  bool IsColorStored(size_t location) const {
+    return colors_stored & (1u << location);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Kill a fragment in the batch. See
+  ///             `FragmentInvocation::Discard`.
+  ///
+  void Discard(size_t index) { discarded |= (1 << index); }
+
+  bool IsDiscarded(size_t index) const { return discarded & (1 << index); }
+
+ private:
+  friend Rasterizer;
+
+  size_t count = 0;
+  LaneMask discarded = 0;
+  std::array<Lanes<ScalarF>, 3> barycentric_coordinates;
+  std::array<Lanes<ScalarF>, 3> perspective_coordinates;
+  std::array<Lanes<glm::vec4>, kMaxColorAttachments> colors;
+  uint32_t colors_stored = 0;
+  const FragmentResources& frag_resources;
+
+  explicit FragmentBatch(const FragmentResources& p_resources)
+      : frag_resources(p_resources) {}
+
+  void Add(const glm::vec3& bary) {
+    barycentric_coordinates[0][count] = bary.x;
+    barycentric_coordinates[1][count] = bary.y;
+    barycentric_coordinates[2][count] = bary.z;
+    const auto perspective =
+        frag_resources.perspective
+            ? frag_resources.GetPerspectiveCoordinates(bary)
+            : bary;
+    perspective_coordinates[0][count] = perspective.x;
+    perspective_coordinates[1][count] = perspective.y;
+    perspective_coordinates[2][count] = perspective.z;
+    count++;
+  }
+};
+
 }  // namespace sft
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <array>
 #include <memory>
 #include <optional>
 
@@ -25,14 +26,32 @@ enum class Winding {
   kCounterClockwise,
 };
 
+enum class ClipDepthRange {
+  /// Depth is in [-1, 1] after the perspective divide. The near plane is at
+  /// z = -w in clip-space. Like projections made by glm without the _ZO suffix.
+  kMinusOneToOne,
+  /// Depth is in [0, 1] after the perspective divide. The near plane is at
+  /// z = 0 in clip-space. Like projections made by glm with the _ZO suffix.
+  kZeroToOne,
+};
+
 struct Pipeline {
-  ColorAttachmentDescriptor color_desc;
+  //----------------------------------------------------------------------------
+  /// The descriptor of each color attachment of the render pass by location.
+  /// Those past the color attachments of the render pass are ignored.
+  ///
+  std::array<ColorAttachmentDescriptor, kMaxColorAttachments> color_descs;
   DepthAttachmentDescriptor depth_desc;
   StencilAttachmentDescriptor stencil_desc;
   std::optional<glm::ivec2> viewport;
   std::shared_ptr<Shader> shader;
   VertexDescriptor vertex_descriptor;
   Winding winding = Winding::kClockwise;
+  //----------------------------------------------------------------------------
+  /// The depth range of the projection used by the shader. Primitives are
+  /// clipped against the near plane it puts in clip-space.
+  ///
+  ClipDepthRange clip_depth_range = ClipDepthRange::kMinusOneToOne;
   std::optional<CullFace> cull_face;
   std::optional<Rect> scissor;
 };
@@ -0,0 +1,60 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "pixel_block.h"
+
+namespace sft {
+
+BlockExtents::BlockExtents(const TriangleEdges& edges, Scalar block_size) {
+  // Sample locations are all within the closed square from the origin of the
+  // block to the origin of the next one. So the extents at its corners bound
+  // the values at all samples.
+  const auto size = kSubPixelScale * block_size;
+  for (size_t i = 0; i < 3; i++) {
+    const auto& edge = edges.edges[i];
+    min[i] = std::min<FixedPoint>(edge.a, 0) * size +  //
+             std::min<FixedPoint>(edge.b, 0) * size;
+    max[i] = std::max<FixedPoint>(edge.a, 0) * size +  //
+             std::max<FixedPoint>(edge.b, 0) * size;
+  }
+}
+
+PixelBlockSetup::PixelBlockSetup(const TriangleEdges& p_edges,
+                                 const glm::vec3& depths,
+                                 SampleCount p_sample_count)
+    : edges(p_edges),
+      sample_count(p_sample_count),
+      depth(p_edges.GetPlaneEquation(depths)),
+      depth_range({std::min({depths.x, depths.y, depths.z}),
+                   std::max({depths.x, depths.y, depths.z})}),
+      depth_block_extents(
+          {std::min(depth.a, 0.0f) * kPixelBlockSize +
+               std::min(depth.b, 0.0f) * kPixelBlockSize,
+           std::max(depth.a, 0.0f) * kPixelBlockSize +
+               std::max(depth.b, 0.0f) * kPixelBlockSize}) {
+  for (size_t i = 0; i < GetSampleCount(sample_count); i++) {
+    sample_locations[i] = GetSampleLocation(sample_count, i);
+    sample_edge_steps[i] = edges.GetStep(ToFixedPoint(sample_locations[i]));
+  }
+  midpoint_edge_step = edges.GetStep(ToFixedPoint(kSampleMidpoint));
+  block_edge_step_x = edges.GetStep({kSubPixelScale * kPixelBlockSize, 0});
+  block_edge_step_y = edges.GetStep({0, kSubPixelScale * kPixelBlockSize});
+  coarse_block_edge_step_x =
+      edges.GetStep({kSubPixelScale * kCoarseBlockSize, 0});
+  coarse_block_edge_step_y =
+      edges.GetStep({0, kSubPixelScale * kCoarseBlockSize});
+  block_extents = BlockExtents{edges, kPixelBlockSize};
+  coarse_block_extents = BlockExtents{edges, kCoarseBlockSize};
+  for (size_t i = 0; i < kPixelBlockLanes; i++) {
+    const auto lane = GetLanePosition(i);
+    const auto step = edges.GetStep(ToFixedPoint(lane));
+    lane_edge_steps[0][i] = step.x;
+    lane_edge_steps[1][i] = step.y;
+    lane_edge_steps[2][i] = step.z;
+    lane_depth_steps[i] = depth.a * lane.x + depth.b * lane.y;
+  }
+}
+
+}  // namespace sft
@@ -0,0 +1,304 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <functional>
+
+#include "attachment.h"
+#include "edge_equation.h"
+#include "geometry.h"
+#include "hi_z_buffer.h"
+#include "macros.h"
+#include "texture.h"
+#include "tile_buffer.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// The fragment stage works on square blocks of pixels at a time. Each pixel in
+/// a block is a lane. Lanes are numbered in row-major order.
+///
+constexpr Scalar kPixelBlockSize = 4;
+constexpr size_t kPixelBlockLanes = kPixelBlockSize * kPixelBlockSize;
+
+//------------------------------------------------------------------------------
+/// Pixel blocks are grouped into coarse blocks that are classified against the
+/// edges of a triangle before any of the pixel blocks within them.
+///
+constexpr Scalar kCoarseBlockSize = 16;
+constexpr size_t kMaxSampleCount = GetSampleCount(SampleCount::kSixteen);
+
+//------------------------------------------------------------------------------
+/// One bit per lane of a block.
+///
+using LaneMask = uint16_t;
+
+constexpr LaneMask kAllLanes = static_cast<LaneMask>(~0u);
+
+template <class T>
+using Lanes = std::array<T, kPixelBlockLanes>;
+
+constexpr glm::ivec2 GetLanePosition(size_t lane) {
+  return {lane % kPixelBlockSize, lane / kPixelBlockSize};
+}
+
+constexpr size_t GetLaneCount(LaneMask mask) {
+  return std::popcount(mask);
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Get the mask of the lanes of the block at the origin that are
+///             within the half-open range of pixels from min to max.
+///
+constexpr LaneMask GetLaneMask(glm::ivec2 origin,
+                               glm::ivec2 min,
+                               glm::ivec2 max) {
+  const auto lo_x = std::max(min.x - origin.x, 0);
+  const auto lo_y = std::max(min.y - origin.y, 0);
+  const auto hi_x = std::min(max.x - origin.x, kPixelBlockSize);
+  const auto hi_y = std::min(max.y - origin.y, kPixelBlockSize);
+  LaneMask row = 0;
+  for (auto x = lo_x; x < hi_x; x++) {
+    row |= 1 << x;
+  }
+  LaneMask mask = 0;
+  for (auto y = lo_y; y < hi_y; y++) {
+    mask |= row << (y * kPixelBlockSize);
+  }
+  return mask;
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Invoke the callback with the index of each lane set in the mask.
+///
+template <class Callback>
+SFT_ALWAYS_INLINE void ForEachLane(LaneMask mask, const Callback& callback) {
+  while (mask != 0) {
+    const auto lane = std::countr_zero(mask);
+    callback(static_cast<size_t>(lane));
+    mask &= mask - 1;
+  }
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Compare all lanes at once. The loop has no branches so that it
+///             can be vectorized.
+///
+template <class T, class Op>
+SFT_ALWAYS_INLINE LaneMask CompareLanes(const Lanes<T>& lhs,
+                                        const Lanes<T>& rhs,
+                                        Op op) {
+  LaneMask mask = 0;
+  for (size_t i = 0; i < kPixelBlockLanes; i++) {
+    mask |= static_cast<LaneMask>(op(lhs[i], rhs[i])) << i;
+  }
+  return mask;
+}
+
+template <class T>
+LaneMask CompareLanes(CompareFunction comp,
+                      const Lanes<T>& lhs,
+                      const Lanes<T>& rhs) {
+  switch (comp) {
+    case CompareFunction::kNever:
+      return 0;
+    case CompareFunction::kAlways:
+      return kAllLanes;
+    case CompareFunction::kLess:
+      return CompareLanes(lhs, rhs, std::less<T>{});
+    case CompareFunction::kEqual:
+      return CompareLanes(lhs, rhs, std::equal_to<T>{});
+    case CompareFunction::kLessEqual:
+      return CompareLanes(lhs, rhs, std::less_equal<T>{});
+    case CompareFunction::kGreater:
+      return CompareLanes(lhs, rhs, std::greater<T>{});
+    case CompareFunction::kNotEqual:
+      return CompareLanes(lhs, rhs, std::not_equal_to<T>{});
+    case CompareFunction::kGreaterEqual:
+      return CompareLanes(lhs, rhs, std::greater_equal<T>{});
+  }
+  return kAllLanes;
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Read the values of one sample of the pixels in a block whose
+///             lanes are set in the mask. Other lanes are left default
+///             initialized as they may be outside the texture.
+///
+template <class T>
+SFT_ALWAYS_INLINE Lanes<T> LoadLanes(const TileBuffer<T>& buffer,
+                                     LaneMask mask,
+                                     glm::ivec2 origin,
+                                     size_t sample) {
+  Lanes<T> lanes = {};
+  if (mask == kAllLanes) {
+    for (size_t i = 0; i < kPixelBlockLanes; i++) {
+      lanes[i] = *buffer.Get(origin + GetLanePosition(i), sample);
+    }
+  } else {
+    ForEachLane(mask, [&](size_t lane) {
+      lanes[lane] = *buffer.Get(origin + GetLanePosition(lane), sample);
+    });
+  }
+  return lanes;
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Write the values of one sample of the pixels in a block whose
+///             lanes are set in the mask.
+///
+template <class T>
+SFT_ALWAYS_INLINE void StoreLanes(TileBuffer<T>& buffer,
+                                  LaneMask mask,
+                                  const Lanes<T>& lanes,
+                                  glm::ivec2 origin,
+                                  size_t sample) {
+  ForEachLane(mask, [&](size_t lane) {
+    buffer.Set(lanes[lane], origin + GetLanePosition(lane), sample);
+  });
+}
+
+//------------------------------------------------------------------------------
+/// How much of a block is covered by a triangle.
+///
+enum class BlockCoverage {
+  /// None of the samples in the block are inside the triangle.
+  kOutside,
+  /// Some of the samples may be inside the triangle. They need to be tested
+  /// individually.
+  kPartial,
+  /// All of the samples in the block are inside the triangle.
+  kInside,
+};
+
+//------------------------------------------------------------------------------
+/// @brief      The smallest and largest offsets of each edge function from its
+///             value at the origin of a square block. These are at opposite
+///             corners of the block.
+///
+struct BlockExtents {
+  FixedPoint3 min;
+  FixedPoint3 max;
+
+  BlockExtents() = default;
+
+  BlockExtents(const TriangleEdges& edges, Scalar block_size);
+};
+
+//------------------------------------------------------------------------------
+/// @brief      The offsets of the edge functions and depth of a triangle from
+///             their values at the origin of a block. These are the same for
+///             every block the triangle touches and are computed once.
+///
+struct PixelBlockSetup {
+  const TriangleEdges& edges;
+  const SampleCount sample_count;
+  PlaneEquation depth;
+  DepthRange depth_range;
+  DepthRange depth_block_extents;
+  std::array<FixedPoint3, kMaxSampleCount> sample_edge_steps;
+  std::array<glm::vec2, kMaxSampleCount> sample_locations;
+  FixedPoint3 midpoint_edge_step;
+  FixedPoint3 block_edge_step_x;
+  FixedPoint3 block_edge_step_y;
+  FixedPoint3 coarse_block_edge_step_x;
+  FixedPoint3 coarse_block_edge_step_y;
+  BlockExtents block_extents;
+  BlockExtents coarse_block_extents;
+  std::array<Lanes<FixedPoint>, 3> lane_edge_steps;
+  Lanes<ScalarF> lane_depth_steps;
+
+  PixelBlockSetup(const TriangleEdges& edges,
+                  const glm::vec3& depths,
+                  SampleCount sample_count);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Classify a block against all three edges at once by checking
+  ///             the corners of the block where each edge function is the
+  ///             largest and the smallest.
+  ///
+  /// @param[in]  block_values  The values of the edge functions at the origin
+  ///                           of the block.
+  /// @param[in]  extents       The extents of the block being classified.
+  ///
+  SFT_ALWAYS_INLINE BlockCoverage Classify(const FixedPoint3& block_values,
+                                           const BlockExtents& extents) const {
+    const auto values = block_values + edges.bias;
+    const auto largest = values + extents.max;
+    if (largest.x < 0 || largest.y < 0 || largest.z < 0) {
+      return BlockCoverage::kOutside;
+    }
+    const auto smallest = values + extents.min;
+    if ((smallest.x | smallest.y | smallest.z) >= 0) {
+      return BlockCoverage::kInside;
+    }
+    return BlockCoverage::kPartial;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Find the lanes whose given sample is inside the triangle.
+  ///
+  /// @param[in]  block_values  The values of the edge functions at the origin
+  ///                           of the block.
+  ///
+  SFT_ALWAYS_INLINE LaneMask GetCoverage(const FixedPoint3& block_values,
+                                         size_t sample) const {
+    const auto values = block_values + sample_edge_steps[sample] + edges.bias;
+    LaneMask mask = 0;
+    for (size_t i = 0; i < kPixelBlockLanes; i++) {
+      // All three edge functions are non-negative if the sign bit isn't set in
+      // any of them.
+      const auto inside = ((values.x + lane_edge_steps[0][i]) |  //
+                           (values.y + lane_edge_steps[1][i]) |  //
+                           (values.z + lane_edge_steps[2][i])    //
+                           ) >= 0;
+      mask |= static_cast<LaneMask>(inside) << i;
+    }
+    return mask;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Interpolate the depth of the given sample in all lanes.
+  ///
+  SFT_ALWAYS_INLINE Lanes<ScalarF> GetDepth(glm::ivec2 block_origin,
+                                            size_t sample) const {
+    const auto base =
+        depth.Evaluate(glm::vec2{block_origin} + sample_locations[sample]);
+    Lanes<ScalarF> lanes;
+    for (size_t i = 0; i < kPixelBlockLanes; i++) {
+      lanes[i] = base + lane_depth_steps[i];
+    }
+    return lanes;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get a range that contains the depth of the triangle at all
+  ///             samples in the block.
+  ///
+  SFT_ALWAYS_INLINE DepthRange GetDepthRange(glm::ivec2 block_origin) const {
+    const auto base = depth.Evaluate(glm::vec2{block_origin});
+    return {
+        std::max(base + depth_block_extents.min, depth_range.min) -
+            kHiZTolerance,
+        std::min(base + depth_block_extents.max, depth_range.max) +
+            kHiZTolerance,
+    };
+  }
+
+  SFT_ALWAYS_INLINE FixedPoint3 GetLaneEdgeStep(size_t lane) const {
+    return {
+        lane_edge_steps[0][lane],
+        lane_edge_steps[1][lane],
+        lane_edge_steps[2][lane],
+    };
+  }
+};
+
+}  // namespace sft
@@ -0,0 +1,125 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "geometry.h"
+#include "macros.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// The formats color attachments may be stored in. Fragments are always shaded
+/// and blended in tiles as 8-bit RGBA colors. They are packed into the format
+/// of the attachment when tiles are stored or resolved.
+///
+enum class PixelFormat {
+  kR8G8B8A8UNormInt,
+  //----------------------------------------------------------------------------
+  /// Opaque colors with half the storage.
+  ///
+  kR5G6B5UNormInt,
+  //----------------------------------------------------------------------------
+  /// Two channel data like vectors.
+  ///
+  kR8G8UNormInt,
+  //----------------------------------------------------------------------------
+  /// Single channel data like masks and coverage.
+  ///
+  kR8UNormInt,
+};
+
+struct ColorR5G6B5 {
+  uint16_t value = 0;
+};
+
+struct ColorR8G8 {
+  uint8_t red = 0;
+  uint8_t green = 0;
+};
+
+struct ColorR8 {
+  uint8_t red = 0;
+};
+
+//------------------------------------------------------------------------------
+/// @brief      Packs and unpacks the colors of pixels of the format. Channels
+///             missing from the format unpack as zero. Alpha as opaque.
+///
+template <class Pixel>
+struct PixelFormatTraits;
+
+template <>
+struct PixelFormatTraits<Color> {
+  static constexpr PixelFormat kFormat = PixelFormat::kR8G8B8A8UNormInt;
+
+  static constexpr Color Pack(Color color) { return color; }
+
+  static constexpr Color Unpack(Color color) { return color; }
+};
+
+template <>
+struct PixelFormatTraits<ColorR5G6B5> {
+  static constexpr PixelFormat kFormat = PixelFormat::kR5G6B5UNormInt;
+
+  static constexpr ColorR5G6B5 Pack(Color color) {
+    const uint32_t red = (color.red * 31u + 127u) / 255u;
+    const uint32_t green = (color.green * 63u + 127u) / 255u;
+    const uint32_t blue = (color.blue * 31u + 127u) / 255u;
+    return {static_cast<uint16_t>((red << 11u) | (green << 5u) | blue)};
+  }
+
+  static constexpr Color Unpack(ColorR5G6B5 color) {
+    const uint32_t red = (color.value >> 11u) & 0x1Fu;
+    const uint32_t green = (color.value >> 5u) & 0x3Fu;
+    const uint32_t blue = color.value & 0x1Fu;
+    return Color{static_cast<uint8_t>((red * 255u + 15u) / 31u),
+                 static_cast<uint8_t>((green * 255u + 31u) / 63u),
+                 static_cast<uint8_t>((blue * 255u + 15u) / 31u),  //
+                 255u};
+  }
+};
+
+template <>
+struct PixelFormatTraits<ColorR8G8> {
+  static constexpr PixelFormat kFormat = PixelFormat::kR8G8UNormInt;
+
+  static constexpr ColorR8G8 Pack(Color color) {
+    return {color.red, color.green};
+  }
+
+  static constexpr Color Unpack(ColorR8G8 color) {
+    return Color{color.red, color.green, 0u, 255u};
+  }
+};
+
+template <>
+struct PixelFormatTraits<ColorR8> {
+  static constexpr PixelFormat kFormat = PixelFormat::kR8UNormInt;
+
+  static constexpr ColorR8 Pack(Color color) { return {color.red}; }
+
+  static constexpr Color Unpack(ColorR8 color) {
+    return Color{color.red, 0u, 0u, 255u};
+  }
+};
+
+constexpr size_t GetBytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kR8G8B8A8UNormInt:
+      return sizeof(Color);
+    case PixelFormat::kR5G6B5UNormInt:
+      return sizeof(ColorR5G6B5);
+    case PixelFormat::kR8G8UNormInt:
+      return sizeof(ColorR8G8);
+    case PixelFormat::kR8UNormInt:
+      return sizeof(ColorR8);
+  }
+  return 0u;
+}
+
+}  // namespace sft
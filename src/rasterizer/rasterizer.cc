@@ -5,136 +5,164 @@
 
 #include "rasterizer.h"
 
+#include <bit>
 #include <cfloat>
-
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "clipper.h"
+#include "edge_equation.h"
 #include "image.h"
 #include "invocation.h"
 #include "macros.h"
 #include "mapping.h"
+#include "marl/scheduler.h"
+#include "marl/waitgroup.h"
+#include "vertex_cache.h"
 
 namespace sft {
 
 Rasterizer::Rasterizer(glm::ivec2 size, SampleCount sample_count)
-    : pass_(size, sample_count) {
+    : pass_(size, sample_count),
+      tiler_(std::make_unique<Tiler>()),
+      submitted_tiler_(std::make_unique<Tiler>()) {
   size_ = pass_.GetSize();
+  tiler_->Resize(size_);
+  submitted_tiler_->Resize(size_);
 }
 
-Rasterizer::~Rasterizer() = default;
+Rasterizer::~Rasterizer() {
+  Wait();
+}
 
 glm::ivec2 Rasterizer::GetSize() const {
   return pass_.GetSize();
 }
 
-constexpr bool IsOOB(glm::ivec2 pos, glm::ivec2 size) {
-  return pos.x < 0 || pos.y < 0 || pos.x >= size.x || pos.y >= size.y;
+LaneMask Rasterizer::FragmentPassesDepthTest(const Pipeline& pipeline,
+                                             glm::ivec2 origin,
+                                             LaneMask mask,
+                                             const Lanes<ScalarF>& new_values,
+                                             size_t sample,
+                                             const Tile& tile) const {
+  const auto current_values = LoadLanes(tile.depth, mask, origin, sample);
+
+  return CompareLanes(pipeline.depth_desc.depth_compare,  //
+                      new_values,                         //
+                      current_values                      //
+                      ) &
+         mask;
 }
 
-bool Rasterizer::FragmentPassesDepthTest(const Pipeline& pipeline,
-                                         glm::ivec2 pos,
-                                         ScalarF new_value,
-                                         size_t sample) const {
-  if (IsOOB(pos, size_)) {
-    return false;
-  }
-
-  if (!pipeline.depth_desc.depth_test_enabled) {
-    return true;
-  }
+LaneMask Rasterizer::FragmentPassesStencilTest(const Pipeline& pipeline,
+                                               glm::ivec2 origin,
+                                               LaneMask mask,
+                                               uint32_t reference_value,
+                                               size_t sample,
+                                               const Tile& tile) const {
+  const auto read_mask = pipeline.stencil_desc.read_mask;
 
-  const auto current_value = *pass_.depth.texture->Get(pos, sample);
+  const auto stencil_values = LoadLanes(tile.stencil, mask, origin, sample);
 
-  return CompareFunctionPasses(pipeline.depth_desc.depth_compare,  //
-                               new_value,                          //
-                               current_value                       //
-  );
-}
-
-bool Rasterizer::UpdateAndCheckFragmentPassesStencilTest(
-    const Pipeline& pipeline,
-    glm::ivec2 pos,
-    bool depth_test_passes,
-    uint32_t reference_value,
-    size_t sample) {
-  if (IsOOB(pos, size_)) {
-    return false;
+  Lanes<uint32_t> current_values;
+  Lanes<uint32_t> reference_values;
+  for (size_t i = 0; i < kPixelBlockLanes; i++) {
+    current_values[i] = read_mask & stencil_values[i];
+    reference_values[i] = read_mask & reference_value;
   }
 
-  if (!pipeline.stencil_desc.stencil_test_enabled) {
-    return true;
-  }
+  return CompareLanes(pipeline.stencil_desc.stencil_compare,  //
+                      current_values,                         //
+                      reference_values                        //
+                      ) &
+         mask;
+}
 
+void Rasterizer::UpdateStencil(const Pipeline& pipeline,
+                               glm::ivec2 origin,
+                               LaneMask mask,
+                               LaneMask depth_test_passes,
+                               LaneMask stencil_test_passes,
+                               uint32_t reference_value,
+                               size_t sample,
+                               Tile& tile) {
   const auto read_mask = pipeline.stencil_desc.read_mask;
   const auto write_mask = pipeline.stencil_desc.write_mask;
 
-  const auto current_value = *pass_.stencil.texture->Get(pos, sample);
-
-  const auto stencil_test_passes =
-      CompareFunctionPasses(pipeline.stencil_desc.stencil_compare,  //
-                            read_mask & current_value,              //
-                            read_mask & reference_value             //
-      );
-
-  //------------------------------------------------------------------------
-  // Determine the new stencil value.
-  //------------------------------------------------------------------------
-  const auto stencil_op =
-      pipeline.stencil_desc.SelectOperation(depth_test_passes,   //
-                                            stencil_test_passes  //
-      );
-
-  const auto new_stencil_value =
-      StencilOperationPerform(
-          stencil_op,                  // selected stencil operation
-          read_mask & current_value,   // current stencil value
-          read_mask & reference_value  // stencil reference value
-          ) &
-      write_mask;
-
-  //------------------------------------------------------------------------
-  // Update the stencil value.
-  //------------------------------------------------------------------------
-  pass_.stencil.texture->Set(new_stencil_value, pos, sample);
-
-  return stencil_test_passes;
+  ForEachLane(mask, [&](size_t lane) {
+    const auto lane_mask = 1 << lane;
+    const auto pos = origin + GetLanePosition(lane);
+    const auto current_value = *tile.stencil.Get(pos, sample);
+
+    //--------------------------------------------------------------------------
+    // Determine the new stencil value.
+    //--------------------------------------------------------------------------
+    const auto stencil_op = pipeline.stencil_desc.SelectOperation(
+        depth_test_passes & lane_mask,   //
+        stencil_test_passes & lane_mask  //
+    );
+
+    const auto new_stencil_value =
+        StencilOperationPerform(
+            stencil_op,                  // selected stencil operation
+            read_mask & current_value,   // current stencil value
+            read_mask & reference_value  // stencil reference value
+            ) &
+        write_mask;
+
+    //--------------------------------------------------------------------------
+    // Update the stencil value.
+    //--------------------------------------------------------------------------
+    tile.stencil.Set(new_stencil_value, pos, sample);
+  });
 }
 
+template <bool kBlend>
 void Rasterizer::UpdateColor(const ColorAttachmentDescriptor& color_desc,
                              const glm::ivec2& pos,
                              const Color& src,
-                             size_t sample) {
-  if (IsOOB(pos, size_)) {
-    return;
-  }
-  if (color_desc.blend.enabled) {
-    auto dst = *pass_.color.texture->Get(pos, sample);
+                             size_t sample,
+                             CompressedTileBuffer<Color>& buffer) {
+  if constexpr (kBlend) {
+    auto dst = *buffer.Get(pos, sample);
     auto color = color_desc.blend.Blend(src, dst);
-    pass_.color.texture->Set(color, pos, sample);
+    buffer.Set(color, pos, sample);
   } else {
-    pass_.color.texture->Set(src, pos, sample);
+    buffer.Set(src, pos, sample);
   }
 }
 
-void Rasterizer::UpdateDepth(const DepthAttachmentDescriptor& depth_desc,
-                             const glm::ivec2& pos,
-                             ScalarF depth,
-                             size_t sample) {
-  if (IsOOB(pos, size_)) {
-    return;
-  }
-  if (!depth_desc.depth_test_enabled) {
-    return;
-  }
-  if (!depth_desc.depth_write_enabled) {
-    return;
+template <bool kBlend>
+void Rasterizer::UpdatePixelColor(const ColorAttachmentDescriptor& color_desc,
+                                  const glm::ivec2& pos,
+                                  const Color& src,
+                                  CompressedTileBuffer<Color>& buffer) {
+  if constexpr (kBlend) {
+    //--------------------------------------------------------------------------
+    // Blending the same color with different destination colors gives
+    // different results. Those samples must be blended separately.
+    //--------------------------------------------------------------------------
+    if (!buffer.IsUniform(pos)) {
+      const auto sample_count = sft::GetSampleCount(buffer.GetSampleCount());
+      for (size_t sample = 0; sample < sample_count; sample++) {
+        UpdateColor<kBlend>(color_desc, pos, src, sample, buffer);
+      }
+      return;
+    }
+    auto dst = *buffer.Get(pos, 0);
+    buffer.SetPixel(color_desc.blend.Blend(src, dst), pos);
+  } else {
+    buffer.SetPixel(src, pos);
   }
-  pass_.depth.texture->Set(depth, pos, sample);
 }
 
 void Rasterizer::Clear(Color color) {
-  pass_.color.clear_color = color;
-  pass_.Load();
+  clear_color_ = color;
   metrics_.area = pass_.GetSize();
-  tiler_.Reset();
+  tiler_->Reset();
 }
 
 constexpr glm::vec3 ToNDC(const glm::vec4& clip) {
@@ -159,17 +187,6 @@ constexpr Rect GetBoundingBox(glm::ivec2 p1, glm::ivec2 p2, glm::ivec2 p3) {
   return Rect{{min.x, min.y}, {max.x - min.x, max.y - min.y}};
 }
 
-constexpr glm::vec3 GetBaryCentricCoordinates(glm::vec2 p,
-                                              glm::vec2 a,
-                                              glm::vec2 b,
-                                              glm::vec2 c) {
-  glm::vec2 ab = b - a, ac = c - a, ap = p - a;
-  float one_over_den = 1.0f / (ab.x * ac.y - ab.y * ac.x);
-  float s = (ac.y * ap.x - ac.x * ap.y) * one_over_den;
-  float t = (ab.x * ap.y - ab.y * ap.x) * one_over_den;
-  return {1.0f - s - t, s, t};
-}
-
 constexpr bool ShouldCullFace(CullFace face,
                               Winding winding,
                               glm::vec3 a,
@@ -187,211 +204,679 @@ constexpr bool ShouldCullFace(CullFace face,
   return dir < 0;
 }
 
-//------------------------------------------------------------------------------
-/// @brief      Return if a point `p` is on the left, right or on the line from
-///             `v0` to `v1`.
-///
-/// @param[in]  v0    The point v0.
-/// @param[in]  v1    The point v1.
-/// @param[in]  p     The point p.
-///
-/// @return     Less than 0 if on the left, greater than zero if one the right
-///             and zero if on the line.
-///
-constexpr ScalarF EdgeFunction(const glm::vec2& v0,
-                               const glm::vec2& v1,
-                               const glm::vec2& p) {
-  return (p.x - v0.x) * (v1.y - v0.y) - (p.y - v0.y) * (v1.x - v0.x);
-}
+template <class Variant>
+void Rasterizer::ShadeBlock(const FragmentResources& tiler_data,
+                            const PixelBlockSetup& setup,
+                            glm::ivec2 origin,
+                            const FixedPoint3& block_values,
+                            LaneMask mask,
+                            bool inside,
+                            Tile& tile) {
+  const auto& pipeline = *tiler_data.pipeline;
 
-static bool IsTopLeftEdge(const glm::vec2& edge) {
-  // Top edges are flat (y == 0) and go right (x == 0).
-  const auto is_top =
-      glm::epsilonEqual(edge.y, 0.0f, kEpsilon) && edge.x > 0.0f;
+  //----------------------------------------------------------------------------
+  // Reject the block if it is entirely behind the depth buffer.
+  //----------------------------------------------------------------------------
+  if constexpr (Variant::kHiZ) {
+    if (DepthRangeFails(
+            pipeline.depth_desc.depth_compare,  //
+            setup.GetDepthRange(origin),        //
+            pass_.depth.hi_z.GetExactRange(origin, tile.depth))) {
+      tile.metrics.hi_z_culled_blocks++;
+      return;
+    }
+  }
 
-  // Left edges are ones that go up.
-  const auto is_left = edge.y > 0.0f;
+  Lanes<uint32_t> samples_found = {};
+  LaneMask lanes_found = 0;
+  LaneMask lanes_covered = 0;
+  DepthRange depth_written = {std::numeric_limits<ScalarF>::infinity(),
+                              -std::numeric_limits<ScalarF>::infinity()};
 
-  return is_top || is_left;
-}
+  //----------------------------------------------------------------------------
+  // If the shader may discard fragments, depth and stencil updates must wait
+  // till after shading. The results of the tests are saved till then.
+  //----------------------------------------------------------------------------
+  struct LateTests {
+    std::array<LaneMask, Variant::kSampleCount> coverage = {};
+    std::array<LaneMask, Variant::kSampleCount> depth_test_passes = {};
+    std::array<LaneMask, Variant::kSampleCount> stencil_test_passes = {};
+    std::array<Lanes<ScalarF>, Variant::kSampleCount> depth;
+  };
+  [[maybe_unused]] std::conditional_t<Variant::kMayDiscard, LateTests, bool>
+      late_tests = {};
+
+  for (size_t sample = 0; sample < Variant::kSampleCount; sample++) {
+    //--------------------------------------------------------------------------
+    // Blocks entirely inside the primitive don't need per-sample edge tests.
+    //--------------------------------------------------------------------------
+    const auto coverage =
+        inside ? mask : setup.GetCoverage(block_values, sample) & mask;
+
+    if (coverage == 0) {
+      continue;
+    }
 
-static bool PointInside(const glm::vec2& a,
-                        const glm::vec2& b,
-                        const glm::vec2& c,
-                        const glm::vec2& p) {
-  const auto edge_ab = EdgeFunction(a, b, p);
-  const auto edge_bc = EdgeFunction(b, c, p);
-  const auto edge_ca = EdgeFunction(c, a, p);
+    //--------------------------------------------------------------------------
+    // Perform the depth test.
+    //--------------------------------------------------------------------------
+    Lanes<ScalarF> depth;
+    LaneMask depth_test_passes = coverage;
+    if constexpr (Variant::kDepthTest) {
+      depth = setup.GetDepth(origin, sample);
+      depth_test_passes = FragmentPassesDepthTest(pipeline, origin, coverage,
+                                                  depth, sample, tile);
+    }
 
-  // The point is clearly not in the triangle or an edge.
-  if (edge_ab < -kEpsilon || edge_bc < -kEpsilon || edge_ca < -kEpsilon) {
-    return false;
-  }
+    //--------------------------------------------------------------------------
+    // Perform the stencil test.
+    //--------------------------------------------------------------------------
+    LaneMask stencil_test_passes = coverage;
+    if constexpr (Variant::kStencilTest) {
+      stencil_test_passes =
+          FragmentPassesStencilTest(pipeline,                      //
+                                    origin,                        //
+                                    coverage,                      //
+                                    tiler_data.stencil_reference,  //
+                                    sample,                        //
+                                    tile                           //
+          );
+      if constexpr (!Variant::kMayDiscard) {
+        UpdateStencil(pipeline,                      //
+                      origin,                        //
+                      coverage,                      //
+                      depth_test_passes,             //
+                      stencil_test_passes,           //
+                      tiler_data.stencil_reference,  //
+                      sample,                        //
+                      tile                           //
+        );
+      }
+    }
 
-  // Check if the triangle is on the edge. If it is, we need to apply the
-  // Top-Left rule.
-  // https://learn.microsoft.com/en-us/windows/win32/direct3d11/d3d10-graphics-programming-guide-rasterizer-stage-rules
-  const auto on_ab = glm::epsilonEqual(edge_ab, 0.0f, kEpsilon);
-  const auto on_bc = glm::epsilonEqual(edge_bc, 0.0f, kEpsilon);
-  const auto on_ca = glm::epsilonEqual(edge_ca, 0.0f, kEpsilon);
+    //--------------------------------------------------------------------------
+    // If either the depth stencil tests have failed, short circuit fragment
+    // processing.
+    //--------------------------------------------------------------------------
+    const LaneMask passes = coverage & depth_test_passes & stencil_test_passes;
+    tile.metrics.early_fragment_test += GetLaneCount(coverage & ~passes);
+
+    //--------------------------------------------------------------------------
+    // Update the depth values.
+    //--------------------------------------------------------------------------
+    if constexpr (Variant::kMayDiscard) {
+      late_tests.coverage[sample] = coverage;
+      late_tests.depth_test_passes[sample] = depth_test_passes;
+      late_tests.stencil_test_passes[sample] = stencil_test_passes;
+      late_tests.depth[sample] = depth;
+    } else if constexpr (Variant::kDepthWrite) {
+      StoreLanes(tile.depth, passes, depth, origin, sample);
+      ForEachLane(passes, [&](size_t lane) {
+        depth_written = depth_written.Union({depth[lane], depth[lane]});
+      });
+    }
 
-  const auto ab = b - a;
-  const auto bc = c - b;
-  const auto ca = a - c;
+    //--------------------------------------------------------------------------
+    // Record the primitive now visible at these samples. It is shaded later.
+    //--------------------------------------------------------------------------
+    if constexpr (Variant::kDeferShading) {
+      Lanes<uint32_t> ids;
+      ids.fill(tiler_data.id);
+      StoreLanes(tile.visibility, passes, ids, origin, sample);
+    }
 
-  if (on_ab && !IsTopLeftEdge(ab)) {
-    return false;
+    //--------------------------------------------------------------------------
+    // These sample locations need a color value.
+    //--------------------------------------------------------------------------
+    ForEachLane(passes, [&](size_t lane) {
+      samples_found[lane] |= (1 << sample);
+    });
+    lanes_found |= passes;
+    lanes_covered |= coverage;
   }
 
-  if (on_bc && !IsTopLeftEdge(bc)) {
-    return false;
+  //----------------------------------------------------------------------------
+  // Fragments that may be discarded and that update the stencil buffer must be
+  // shaded even if they fail the tests. Fragments that defer shading are only
+  // shaded once it is known that they are visible.
+  //----------------------------------------------------------------------------
+  LaneMask lanes_shaded = lanes_found;
+  if constexpr (Variant::kDeferShading) {
+    lanes_shaded = 0;
+  } else if constexpr (Variant::kMayDiscard && Variant::kStencilTest) {
+    lanes_shaded = lanes_covered;
   }
 
-  if (on_ca && !IsTopLeftEdge(ca)) {
-    return false;
+  FragmentBatch batch(tiler_data);
+  if (lanes_shaded != 0) {
+    //--------------------------------------------------------------------------
+    // Shade the fragments. But just once for all samples.
+    //--------------------------------------------------------------------------
+    ForEachLane(lanes_shaded, [&](size_t lane) {
+      batch.Add(setup.edges.GetBarycentricCoordinates(
+          block_values + setup.GetLaneEdgeStep(lane) +
+          setup.midpoint_edge_step));
+    });
+    pipeline.shader->ProcessFragmentBatch(batch);
+    tile.metrics.fragment_invocations += batch.GetCount();
   }
 
-  return true;
-}
+  //----------------------------------------------------------------------------
+  // Perform the depth and stencil updates of the fragments that were not
+  // discarded.
+  //----------------------------------------------------------------------------
+  if constexpr (Variant::kMayDiscard) {
+    LaneMask lanes_kept = 0;
+    size_t index = 0;
+    ForEachLane(lanes_shaded, [&](size_t lane) {
+      if (!batch.IsDiscarded(index++)) {
+        lanes_kept |= (1 << lane);
+      }
+    });
+    tile.metrics.discarded_fragments +=
+        GetLaneCount(lanes_shaded & ~lanes_kept);
+    lanes_found &= lanes_kept;
+
+    for (size_t sample = 0; sample < Variant::kSampleCount; sample++) {
+      const LaneMask coverage = late_tests.coverage[sample] & lanes_kept;
+      if (coverage == 0) {
+        continue;
+      }
+      if constexpr (Variant::kStencilTest) {
+        UpdateStencil(pipeline,                                //
+                      origin,                                  //
+                      coverage,                                //
+                      late_tests.depth_test_passes[sample],    //
+                      late_tests.stencil_test_passes[sample],  //
+                      tiler_data.stencil_reference,            //
+                      sample,                                  //
+                      tile                                     //
+        );
+      }
+      if constexpr (Variant::kDepthWrite) {
+        const auto& depth = late_tests.depth[sample];
+        const LaneMask passes = coverage &
+                                late_tests.depth_test_passes[sample] &
+                                late_tests.stencil_test_passes[sample];
+        StoreLanes(tile.depth, passes, depth, origin, sample);
+        ForEachLane(passes, [&](size_t lane) {
+          depth_written = depth_written.Union({depth[lane], depth[lane]});
+        });
+      }
+    }
+  }
 
-void Rasterizer::ShadeFragments(const FragmentResources& tiler_data,
-                                const Rect& tile) {
-  auto box = tiler_data.box.Intersection(tile);
-  if (!box.has_value()) {
-    return;
+  //----------------------------------------------------------------------------
+  // Keep the Hi-Z buffer up to date. Even for variants that don't use it.
+  //----------------------------------------------------------------------------
+  if constexpr (Variant::kDepthWrite) {
+    if (lanes_found != 0) {
+      pass_.depth.hi_z.Update(origin, depth_written);
+    }
   }
-  const auto sample_count = pass_.color.texture->GetSampleCount();
-  const auto& pipeline = tiler_data.pipeline;
-  auto viewport = pipeline->viewport.value_or(size_);
-  const auto frag_p1 = ToTexelPos(tiler_data.ndc[0], viewport);
-  const auto frag_p2 = ToTexelPos(tiler_data.ndc[1], viewport);
-  const auto frag_p3 = ToTexelPos(tiler_data.ndc[2], viewport);
+
   //----------------------------------------------------------------------------
-  // Shade fragments.
+  // Blend in the color for found samples into each color attachment the shader
+  // stored colors for. Pixels with all samples found are updated at once.
   //----------------------------------------------------------------------------
-  for (auto y = box->origin.y; y <= box->origin.y + box->size.height; y++) {
-    for (auto x = box->origin.x; x <= box->origin.x + box->size.width; x++) {
-      const auto pixel = glm::vec2{x, y};
-      uint32_t samples_found = 0;
+  constexpr uint32_t kAllSamples = (1u << Variant::kSampleCount) - 1u;
+  for (size_t location = 0; location < pass_.colors.size(); location++) {
+    if (!batch.IsColorStored(location)) {
+      continue;
+    }
+    const auto& color_desc = pipeline.color_descs[location];
+    const auto& batch_colors = batch.colors[location];
+    auto& buffer = tile.colors[location];
+    size_t index = 0;
+    ForEachLane(lanes_shaded, [&](size_t lane) {
+      const auto& batch_color = batch_colors[index++];
+      if ((lanes_found & (1 << lane)) == 0) {
+        return;
+      }
+      const auto color = Color{batch_color};
+      const auto pixel = origin + GetLanePosition(lane);
+      if (samples_found[lane] == kAllSamples) {
+        UpdatePixelColor<Variant::kBlend>(color_desc, pixel, color, buffer);
+        return;
+      }
+      for (size_t sample = 0; sample < Variant::kSampleCount; sample++) {
+        if (samples_found[lane] & (1 << sample)) {
+          UpdateColor<Variant::kBlend>(color_desc,  //
+                                       pixel,       //
+                                       color,       //
+                                       sample,      //
+                                       buffer       //
+          );
+        }
+      }
+    });
+  }
+}
 
-      for (size_t sample = 0; sample < GetSampleCount(sample_count); sample++) {
-        const auto frag = pixel + GetSampleLocation(sample_count, sample);
+void Rasterizer::LoadTile(Tile& tile) const {
+  for (size_t location = 0; location < pass_.colors.size(); location++) {
+    pass_.colors[location].LoadTile(tile.colors[location], tile.min, tile.max);
+  }
+  tile.depth.Setup(tile.min, tile.max, pass_.depth.texture->GetSampleCount());
+  tile.depth.Load(*pass_.depth.texture, pass_.depth.clear_state);
+  tile.stencil.Setup(tile.min, tile.max,
+                     pass_.stencil.texture->GetSampleCount());
+  tile.stencil.Load(*pass_.stencil.texture, pass_.stencil.clear_state);
+}
 
-        if (!PointInside(frag_p1, frag_p2, frag_p3, frag)) {
-          continue;
-        }
+void Rasterizer::StoreTile(const Tile& tile) {
+  //----------------------------------------------------------------------------
+  // The depth and stencil attachments are often only needed while rendering.
+  // Their contents are discarded unless stored. So are the samples of the
+  // color attachments once resolved while they are still in cache.
+  //----------------------------------------------------------------------------
+  for (size_t location = 0; location < pass_.colors.size(); location++) {
+    pass_.colors[location].StoreTile(tile.colors[location]);
+  }
+  if (pass_.depth.ShouldStore()) {
+    tile.depth.Store(*pass_.depth.texture);
+  }
+  if (pass_.stencil.ShouldStore()) {
+    tile.stencil.Store(*pass_.stencil.texture);
+  }
+}
 
-        //----------------------------------------------------------------------
-        // Perform the depth test.
-        //----------------------------------------------------------------------
-        const auto bary =
-            GetBaryCentricCoordinates(frag, frag_p1, frag_p2, frag_p3);
-        const auto depth = BarycentricInterpolation(tiler_data.ndc[0],  //
-                                                    tiler_data.ndc[1],  //
-                                                    tiler_data.ndc[2],  //
-                                                    bary                //
-                                                    )
-                               .z;
-        const auto depth_test_passes =
-            FragmentPassesDepthTest(*pipeline, frag, depth, sample);
+void Rasterizer::MarkTileStored(glm::ivec2 pixel) {
+  for (auto& color : pass_.colors) {
+    color.MarkTileStored(pixel);
+  }
+  if (pass_.depth.ShouldStore()) {
+    pass_.depth.clear_state.MarkStored(pixel);
+  }
+  if (pass_.stencil.ShouldStore()) {
+    pass_.stencil.clear_state.MarkStored(pixel);
+  }
+}
 
-        //----------------------------------------------------------------------
-        // Perform the stencil test.
-        //----------------------------------------------------------------------
-        const auto stencil_test_passes =
-            UpdateAndCheckFragmentPassesStencilTest(
-                *pipeline,                     //
-                frag,                          //
-                depth_test_passes,             //
-                tiler_data.stencil_reference,  //
-                sample                         //
-            );
+void Rasterizer::ShadeFragments(const FragmentResources& tiler_data,
+                                Tile& tile) {
+  if (tiler_data.defer_shading && !tile.visibility.IsValid()) {
+    tile.visibility.Setup(tile.min, tile.max, pass_.GetSampleCount());
+    tile.visibility.Clear(Tile::kNoPrimitive);
+  }
+  const auto log2_sample_count =
+      std::countr_zero(sft::GetSampleCount(pass_.GetSampleCount()));
+  tiler_data.shade_fragments[log2_sample_count](*this, tiler_data, tile);
+}
 
-        //----------------------------------------------------------------------
-        // If either the depth stencil tests have failed, short circuit fragment
-        // processing.
-        //----------------------------------------------------------------------
-        if (!stencil_test_passes || !depth_test_passes) {
-          metrics_.early_fragment_test++;
-          continue;
-        }
+void Rasterizer::ShadeVisibleFragments(Tile& tile) {
+  auto& visibility = tile.visibility;
+  const auto sample_count = sft::GetSampleCount(visibility.GetSampleCount());
+  const auto min = tile.min;
+  const auto max = tile.max;
 
-        //----------------------------------------------------------------------
-        // Update the depth values.
-        //----------------------------------------------------------------------
-        UpdateDepth(pipeline->depth_desc, frag, depth, sample);
+  Lanes<uint32_t> no_primitive;
+  no_primitive.fill(Tile::kNoPrimitive);
 
-        //----------------------------------------------------------------------
-        // This sample location needs a color value.
-        //----------------------------------------------------------------------
-        samples_found |= (1 << sample);
-      }
+  const auto block_min = (min / kPixelBlockSize) * kPixelBlockSize;
+  for (auto y = block_min.y; y < max.y; y += kPixelBlockSize) {
+    for (auto x = block_min.x; x < max.x; x += kPixelBlockSize) {
+      const auto origin = glm::ivec2{x, y};
+      const auto mask = GetLaneMask(origin, min, max);
 
-      if (samples_found == 0) {
+      //------------------------------------------------------------------------
+      // Find the samples of the block that have a visible primitive.
+      //------------------------------------------------------------------------
+      std::array<Lanes<uint32_t>, kMaxSampleCount> ids;
+      std::array<LaneMask, kMaxSampleCount> pending;
+      LaneMask lanes_pending = 0;
+      for (size_t sample = 0; sample < sample_count; sample++) {
+        ids[sample] = LoadLanes(visibility, mask, origin, sample);
+        pending[sample] = CompareLanes(ids[sample], no_primitive,
+                                       std::not_equal_to<uint32_t>{}) &
+                          mask;
+        lanes_pending |= pending[sample];
+      }
+      if (lanes_pending == 0) {
         continue;
       }
 
       //------------------------------------------------------------------------
-      // Shade the fragment. But just once for all samples.
+      // Empty the visibility buffer for the primitives that follow.
       //------------------------------------------------------------------------
-      const auto frag = pixel + kSampleMidpoint;
-      const auto bary =
-          GetBaryCentricCoordinates(frag, frag_p1, frag_p2, frag_p3);
-      const auto color =
-          Color{pipeline->shader->ProcessFragment({bary, tiler_data})};
-      metrics_.fragment_invocations++;
+      for (size_t sample = 0; sample < sample_count; sample++) {
+        StoreLanes(visibility, pending[sample], no_primitive, origin, sample);
+      }
 
       //------------------------------------------------------------------------
-      // Blend in the color for found samples.
+      // Shade the fragments of one primitive visible in the block at a time.
+      // Each pixel is shaded once per primitive visible at any of its samples.
       //------------------------------------------------------------------------
-      for (size_t sample = 0; sample < GetSampleCount(sample_count); sample++) {
-        if (samples_found & (1 << sample)) {
-          const auto frag = pixel + GetSampleLocation(sample_count, sample);
-          UpdateColor(pipeline->color_desc, frag, color, sample);
+      while (lanes_pending != 0) {
+        const auto first_lane = std::countr_zero(lanes_pending);
+        size_t first_sample = 0;
+        while ((pending[first_sample] & (1 << first_lane)) == 0) {
+          first_sample++;
         }
+        const auto id = ids[first_sample][first_lane];
+        Lanes<uint32_t> primitive_ids;
+        primitive_ids.fill(id);
+
+        std::array<LaneMask, kMaxSampleCount> samples_visible;
+        LaneMask lanes_visible = 0;
+        lanes_pending = 0;
+        for (size_t sample = 0; sample < sample_count; sample++) {
+          samples_visible[sample] =
+              CompareLanes(ids[sample], primitive_ids,
+                           std::equal_to<uint32_t>{}) &
+              pending[sample];
+          pending[sample] &= ~samples_visible[sample];
+          lanes_visible |= samples_visible[sample];
+          lanes_pending |= pending[sample];
+        }
+
+        //----------------------------------------------------------------------
+        // Reconstruct the barycentric coordinates at the center of each pixel
+        // from the edges of the primitive.
+        //----------------------------------------------------------------------
+        const auto& tiler_data = submitted_tiler_->GetData(id);
+        const auto& edges = tiler_data.edges;
+        const auto block_values = edges.Evaluate(ToFixedPoint(origin)) +
+                                  edges.GetStep(ToFixedPoint(kSampleMidpoint));
+        FragmentBatch batch(tiler_data);
+        ForEachLane(lanes_visible, [&](size_t lane) {
+          batch.Add(edges.GetBarycentricCoordinates(
+              block_values +
+              edges.GetStep(ToFixedPoint(GetLanePosition(lane)))));
+        });
+        tiler_data.pipeline->shader->ProcessFragmentBatch(batch);
+        tile.metrics.fragment_invocations += batch.GetCount();
+
+        LaneMask lanes_all_samples_visible = lanes_visible;
+        for (size_t sample = 0; sample < sample_count; sample++) {
+          lanes_all_samples_visible &= samples_visible[sample];
+        }
+        for (size_t location = 0; location < pass_.colors.size(); location++) {
+          if (!batch.IsColorStored(location)) {
+            continue;
+          }
+          const auto& batch_colors = batch.colors[location];
+          auto& buffer = tile.colors[location];
+          size_t index = 0;
+          ForEachLane(lanes_visible, [&](size_t lane) {
+            const auto color = Color{batch_colors[index++]};
+            const auto pixel = origin + GetLanePosition(lane);
+            if (lanes_all_samples_visible & (1 << lane)) {
+              buffer.SetPixel(color, pixel);
+              return;
+            }
+            for (size_t sample = 0; sample < sample_count; sample++) {
+              if (samples_visible[sample] & (1 << lane)) {
+                buffer.Set(color, pixel, sample);
+              }
+            }
+          });
+        }
+      }
+    }
+  }
+}
+
+template <class Variant>
+void Rasterizer::ShadeFragmentsVariant(Rasterizer& rasterizer,
+                                       const FragmentResources& tiler_data,
+                                       Tile& tile) {
+  rasterizer.ShadeFragments<Variant>(tiler_data, tile);
+}
+
+template <class Variant>
+void Rasterizer::ShadeFragments(const FragmentResources& tiler_data,
+                                Tile& tile) {
+  //----------------------------------------------------------------------------
+  // Find the pixels in both the bounding box of the primitive and the tile. The
+  // bounding box includes its right and bottom edges. Tiles don't so that
+  // pixels on the boundaries between tiles are only shaded once.
+  //----------------------------------------------------------------------------
+  const auto min =
+      glm::max(glm::ivec2{glm::floor(tiler_data.box.GetLT())}, tile.min);
+  const auto max =
+      glm::min(glm::ivec2{glm::floor(tiler_data.box.GetRB())} + 1, tile.max);
+  if (min.x >= max.x || min.y >= max.y) {
+    return;
+  }
+
+  //----------------------------------------------------------------------------
+  // Reject the primitive in this tile if it is entirely behind the depth
+  // buffer.
+  //----------------------------------------------------------------------------
+  if constexpr (Variant::kHiZ) {
+    const auto& ndc = tiler_data.ndc;
+    const DepthRange range = {
+        std::min({ndc[0].z, ndc[1].z, ndc[2].z}) - kHiZTolerance,
+        std::max({ndc[0].z, ndc[1].z, ndc[2].z}) + kHiZTolerance,
+    };
+    if (DepthRangeFails(tiler_data.pipeline->depth_desc.depth_compare,  //
+                        range,                                          //
+                        pass_.depth.hi_z.GetConservativeRange(min, max)  //
+                        )) {
+      tile.metrics.hi_z_culled_primitives++;
+      return;
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  // Setup the offsets of the edge functions and depth from the origin of each
+  // block once. Blocks are aligned to the block size.
+  //----------------------------------------------------------------------------
+  const PixelBlockSetup setup(tiler_data.edges,
+                              {
+                                  tiler_data.ndc[0].z,
+                                  tiler_data.ndc[1].z,
+                                  tiler_data.ndc[2].z,
+                              },
+                              pass_.GetSampleCount());
+
+  //----------------------------------------------------------------------------
+  // Classify coarse blocks against the edges first so that large empty areas
+  // of the bounding box of thin primitives are skipped quickly.
+  //----------------------------------------------------------------------------
+  const auto coarse_min = (min / kCoarseBlockSize) * kCoarseBlockSize;
+  auto row_values = tiler_data.edges.Evaluate(ToFixedPoint(coarse_min));
+  for (auto y = coarse_min.y; y < max.y;
+       y += kCoarseBlockSize, row_values += setup.coarse_block_edge_step_y) {
+    auto coarse_values = row_values;
+    for (auto x = coarse_min.x; x < max.x; x += kCoarseBlockSize,
+              coarse_values += setup.coarse_block_edge_step_x) {
+      const auto coarse_coverage =
+          setup.Classify(coarse_values, setup.coarse_block_extents);
+      switch (coarse_coverage) {
+        case BlockCoverage::kOutside:
+          tile.metrics.coarse_blocks_rejected++;
+          continue;
+        case BlockCoverage::kInside:
+          tile.metrics.coarse_blocks_accepted++;
+          break;
+        case BlockCoverage::kPartial:
+          break;
       }
+      ShadeCoarseBlock<Variant>(tiler_data,       //
+                                setup,            //
+                                {x, y},           //
+                                coarse_values,    //
+                                coarse_coverage,  //
+                                min,              //
+                                max,              //
+                                tile              //
+      );
     }
   }
 }
 
-void Rasterizer::DrawTriangle(const VertexResources& data) {
-  metrics_.primitive_count++;
+template <class Variant>
+void Rasterizer::ShadeCoarseBlock(const FragmentResources& tiler_data,
+                                  const PixelBlockSetup& setup,
+                                  glm::ivec2 coarse_origin,
+                                  const FixedPoint3& coarse_values,
+                                  BlockCoverage coarse_coverage,
+                                  glm::ivec2 min,
+                                  glm::ivec2 max,
+                                  Tile& tile) {
+  //----------------------------------------------------------------------------
+  // Find the blocks in both the coarse block and the range of pixels to shade.
+  //----------------------------------------------------------------------------
+  const auto block_min =
+      glm::max(coarse_origin, (min / kPixelBlockSize) * kPixelBlockSize);
+  const auto block_max = glm::min(
+      coarse_origin + glm::ivec2{kCoarseBlockSize, kCoarseBlockSize}, max);
+
+  //----------------------------------------------------------------------------
+  // Shade fragments a block at a time. Blocks in a coarse block that is
+  // entirely inside the primitive are as well and need not be classified.
+  //----------------------------------------------------------------------------
+  const auto block_offset = ToFixedPoint(block_min - coarse_origin);
+  auto row_values = coarse_values + setup.edges.GetStep(block_offset);
+  for (auto y = block_min.y; y < block_max.y;
+       y += kPixelBlockSize, row_values += setup.block_edge_step_y) {
+    auto block_values = row_values;
+    for (auto x = block_min.x; x < block_max.x;
+         x += kPixelBlockSize, block_values += setup.block_edge_step_x) {
+      const auto coverage =
+          coarse_coverage == BlockCoverage::kInside
+              ? BlockCoverage::kInside
+              : setup.Classify(block_values, setup.block_extents);
+      if (coverage == BlockCoverage::kOutside) {
+        continue;
+      }
+      const auto origin = glm::ivec2{x, y};
+      ShadeBlock<Variant>(tiler_data,                          //
+                          setup,                               //
+                          origin,                              //
+                          block_values,                        //
+                          GetLaneMask(origin, min, max),       //
+                          coverage == BlockCoverage::kInside,  //
+                          tile                                 //
+      );
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+/// The number of primitives of a draw processed together by a single task.
+///
+constexpr size_t kPrimitiveBatchSize = 1024;
+
+//------------------------------------------------------------------------------
+/// @brief      The primitives of a contiguous range of a draw that have been
+///             through the vertex stage and setup. Batches of a draw are
+///             processed concurrently and merged into the tiler in order.
+///
+struct Rasterizer::PrimitiveBatch {
+  std::vector<FragmentResources> primitives;
+  RasterizerMetrics metrics;
+  VertexCache* vertex_cache = nullptr;
+};
+
+glm::vec4 Rasterizer::ShadeVertex(const VertexResources& data,
+                                  FragmentResources& tiler_data,
+                                  size_t vertex_id,
+                                  PrimitiveBatch& batch) const {
+  auto* varyings = tiler_data.varyings.data() +
+                   tiler_data.GetVaryingsStride() * (vertex_id % 3);
+  auto* cache = batch.vertex_cache;
+  const auto index = cache ? data.LoadVertexIndex(vertex_id) : vertex_id;
+  glm::vec4 position;
+  if (cache && cache->Load(index, position, varyings)) {
+    batch.metrics.vertex_cache_hits++;
+    return position;
+  }
+  VertexInvocation vertex_invocation(data, tiler_data, vertex_id);
+  position = data.pipeline->shader->ProcessVertex(vertex_invocation);
+  batch.metrics.vertex_invocations++;
+  if (cache) {
+    cache->Store(index, position, varyings);
+  }
+  return position;
+}
+
+void Rasterizer::DrawTriangle(const VertexResources& data,
+                              PrimitiveBatch& batch) const {
+  batch.metrics.primitive_count++;
 
   auto tiler_data = FragmentResources{data.pipeline->shader->GetVaryingsSize()};
   tiler_data.stencil_reference = data.stencil_reference;
   tiler_data.pipeline = data.pipeline;
   tiler_data.resources = data.resources;
+  tiler_data.shade_fragments = data.shade_fragments;
+  tiler_data.defer_shading = data.defer_shading;
 
   //----------------------------------------------------------------------------
   // Invoke vertex shaders. The clip-space coordinates returned are specified by
   // homogenous 4D vectors.
   //----------------------------------------------------------------------------
-  VertexInvocation vertex_invocation(data, tiler_data, data.base_vertex_id);
-  const auto clip_p1 = data.pipeline->shader->ProcessVertex(vertex_invocation);
-  vertex_invocation.vtx_index++;
-  const auto clip_p2 = data.pipeline->shader->ProcessVertex(vertex_invocation);
-  vertex_invocation.vtx_index++;
-  const auto clip_p3 = data.pipeline->shader->ProcessVertex(vertex_invocation);
-  metrics_.vertex_invocations += 3;
+  std::array<glm::vec4, 3> clip;
+  for (size_t i = 0; i < 3; i++) {
+    clip[i] = ShadeVertex(data, tiler_data, data.base_vertex_id + i, batch);
+  }
+
+  //----------------------------------------------------------------------------
+  // Clip primitives that cross the near plane or extend beyond the guard band.
+  // Those that are entirely inside both, which is most of them, are setup as
+  // is. Everything else off-screen is left to the scissor.
+  //----------------------------------------------------------------------------
+  const auto viewport = data.pipeline->viewport.value_or(size_);
+  const Clipper clipper(viewport, data.pipeline->clip_depth_range);
+  const auto code_1 = clipper.GetClipCode(clip[0]);
+  const auto code_2 = clipper.GetClipCode(clip[1]);
+  const auto code_3 = clipper.GetClipCode(clip[2]);
+
+  if ((code_1 | code_2 | code_3) == 0) {
+    SetupTriangle(std::move(tiler_data), clip, viewport, batch);
+    return;
+  }
+
+  if ((code_1 & code_2 & code_3) != 0) {
+    batch.metrics.clip_culling++;
+    return;
+  }
+
+  batch.metrics.clipped_primitives++;
+
+  const auto polygon = clipper.Clip(clip, code_1 | code_2 | code_3);
+  for (size_t i = 2; i < polygon.count; i++) {
+    const auto& v1 = polygon.vertices[0];
+    const auto& v2 = polygon.vertices[i - 1];
+    const auto& v3 = polygon.vertices[i];
+    auto clipped_data = tiler_data;
+    clipped_data.InterpolateVaryings(tiler_data, 0, v1.weights);
+    clipped_data.InterpolateVaryings(tiler_data, 1, v2.weights);
+    clipped_data.InterpolateVaryings(tiler_data, 2, v3.weights);
+    SetupTriangle(std::move(clipped_data),                  //
+                  {v1.position, v2.position, v3.position},  //
+                  viewport,                                 //
+                  batch                                     //
+    );
+  }
+}
 
+void Rasterizer::SetupTriangle(FragmentResources tiler_data,
+                               const std::array<glm::vec4, 3>& clip,
+                               const glm::ivec2& viewport,
+                               PrimitiveBatch& batch) const {
   //----------------------------------------------------------------------------
   // Convert clip space coordinates into NDC coordinates (divide by w).
   //----------------------------------------------------------------------------
-  const auto ndc_p1 = ToNDC(clip_p1);
-  const auto ndc_p2 = ToNDC(clip_p2);
-  const auto ndc_p3 = ToNDC(clip_p3);
+  const auto ndc_p1 = ToNDC(clip[0]);
+  const auto ndc_p2 = ToNDC(clip[1]);
+  const auto ndc_p3 = ToNDC(clip[2]);
+
+  const auto& pipeline = *tiler_data.pipeline;
 
   //----------------------------------------------------------------------------
   // Cull faces.
   //----------------------------------------------------------------------------
-  if (data.pipeline->cull_face.has_value()) {
-    if (ShouldCullFace(data.pipeline->cull_face.value(),  //
-                       data.pipeline->winding,            //
-                       ndc_p1,                            //
-                       ndc_p2,                            //
-                       ndc_p3                             //
+  if (pipeline.cull_face.has_value()) {
+    if (ShouldCullFace(pipeline.cull_face.value(),  //
+                       pipeline.winding,            //
+                       ndc_p1,                      //
+                       ndc_p2,                      //
+                       ndc_p3                       //
                        )) {
-      metrics_.face_culling++;
+      batch.metrics.face_culling++;
       return;
     }
   }
@@ -399,7 +884,6 @@ void Rasterizer::DrawTriangle(const VertexResources& data) {
   //----------------------------------------------------------------------------
   // Convert NDC points returned by the shader into screen-space.
   //----------------------------------------------------------------------------
-  auto viewport = data.pipeline->viewport.value_or(size_);
   const auto frag_p1 = ToTexelPos(ndc_p1, viewport);
   const auto frag_p2 = ToTexelPos(ndc_p2, viewport);
   const auto frag_p3 = ToTexelPos(ndc_p3, viewport);
@@ -410,15 +894,25 @@ void Rasterizer::DrawTriangle(const VertexResources& data) {
   const auto bounding_box = GetBoundingBox(frag_p1, frag_p2, frag_p3);
 
   if (bounding_box.size.IsEmpty()) {
-    metrics_.empty_primitive++;
+    batch.metrics.empty_primitive++;
+    return;
+  }
+
+  //----------------------------------------------------------------------------
+  // Snap the vertices to the sub-pixel grid and setup the edge equations.
+  //----------------------------------------------------------------------------
+  const auto edges = TriangleEdges::Make(frag_p1, frag_p2, frag_p3);
+
+  if (!edges.has_value()) {
+    batch.metrics.empty_primitive++;
     return;
   }
 
   auto scissor_box =
-      bounding_box.Intersection(data.pipeline->scissor.value_or(Rect{size_}));
+      bounding_box.Intersection(pipeline.scissor.value_or(Rect{size_}));
 
   if (!scissor_box.has_value()) {
-    metrics_.scissor_culling++;
+    batch.metrics.scissor_culling++;
     return;
   }
 
@@ -429,18 +923,25 @@ void Rasterizer::DrawTriangle(const VertexResources& data) {
   // From https://developer.arm.com/documentation/102540/0100/Primitive-culling
   //----------------------------------------------------------------------------
   if (box.size.width < 2 && box.size.height < 2) {
-    metrics_.sample_point_culling++;
+    batch.metrics.sample_point_culling++;
     return;
   }
 
-  metrics_.primitives_processed++;
+  batch.metrics.primitives_processed++;
 
   tiler_data.box = box;
   tiler_data.ndc[0] = ndc_p1;
   tiler_data.ndc[1] = ndc_p2;
   tiler_data.ndc[2] = ndc_p3;
+  tiler_data.edges = edges.value();
 
-  tiler_.AddData(std::move(tiler_data));
+  //----------------------------------------------------------------------------
+  // Setup the plane equations of the varyings once so that fragments only
+  // need to evaluate them.
+  //----------------------------------------------------------------------------
+  tiler_data.SetupVaryings({clip[0].w, clip[1].w, clip[2].w});
+
+  batch.primitives.emplace_back(std::move(tiler_data));
 }
 
 void Rasterizer::ResetMetrics() {
@@ -466,17 +967,76 @@ bool Rasterizer::Resize(glm::ivec2 size) {
   if (size_ == size) {
     return true;
   }
+  Wait();
   if (!pass_.Resize(size)) {
     return false;
   }
   size_ = size;
+  tiler_->Resize(size_);
+  submitted_tiler_->Resize(size_);
   return true;
 }
 
+bool Rasterizer::ResizeSamples(SampleCount count) {
+  if (pass_.GetSampleCount() == count) {
+    return true;
+  }
+  Wait();
+  return pass_.SetSampleCount(count);
+}
+
+SampleCount Rasterizer::GetSampleCount() const {
+  return pass_.GetSampleCount();
+}
+
+size_t Rasterizer::GetColorAttachmentCount() const {
+  return pass_.colors.size();
+}
+
+bool Rasterizer::SetColorAttachmentCount(size_t count) {
+  if (pass_.colors.size() == count) {
+    return true;
+  }
+  Wait();
+  return pass_.SetColorAttachmentCount(count);
+}
+
 RenderPassAttachments& Rasterizer::GetRenderPassAttachments() {
+  Wait();
+  // Write the clears of tiles no primitive was drawn to.
+  pass_.Store();
   return pass_;
 }
 
+void Rasterizer::SetVisibilityBufferEnabled(bool enabled) {
+  visibility_buffer_enabled_ = enabled;
+}
+
+bool Rasterizer::IsVisibilityBufferEnabled() const {
+  return visibility_buffer_enabled_;
+}
+
+//------------------------------------------------------------------------------
+/// Whether the pipeline blends into any of its color attachments.
+///
+static bool IsBlendEnabled(const Pipeline& pipeline) {
+  return std::any_of(
+      pipeline.color_descs.begin(), pipeline.color_descs.end(),
+      [](const auto& color_desc) { return color_desc.blend.enabled; });
+}
+
+//------------------------------------------------------------------------------
+/// Only the fragments of opaque primitives that pass the depth test and update
+/// nothing but the depth and color attachments can be shaded after all
+/// primitives have been rasterized.
+///
+static bool CanDeferShading(const Pipeline& pipeline) {
+  return pipeline.depth_desc.depth_test_enabled &&
+         pipeline.depth_desc.depth_write_enabled &&
+         !pipeline.stencil_desc.stencil_test_enabled &&
+         !IsBlendEnabled(pipeline) && !pipeline.shader->MayDiscard();
+}
+
 void Rasterizer::Draw(std::shared_ptr<Pipeline> pipeline,
                       const BufferView& vertex_buffer,
                       const BufferView& index_buffer,
@@ -485,20 +1045,72 @@ void Rasterizer::Draw(std::shared_ptr<Pipeline> pipeline,
                       uint32_t stencil_reference) {
   metrics_.draw_count++;
   auto resources = std::make_shared<DispatchResources>();
+  resources->pipeline = *pipeline;
+  // Only the copy is read from here on. It lives as long as the resources.
+  pipeline = std::shared_ptr<Pipeline>(resources, &resources->pipeline);
   resources->vertex = std::move(vertex_buffer);
   resources->index = std::move(index_buffer);
   resources->uniform = std::move(uniforms);
+  resources->varying_interpolation =
+      pipeline->shader->GetVaryingInterpolation();
   VertexResources data(pipeline,              //
                        std::move(resources),  //
                        stencil_reference      //
   );
-  const auto vtx_offset = pipeline->vertex_descriptor.offset;
-  for (size_t i = 0; i < count; i += 3) {
-    data.base_vertex_id = i;
-    data.vtx[0] = data.LoadVertexData<glm::vec3>(i + 0, vtx_offset);
-    data.vtx[1] = data.LoadVertexData<glm::vec3>(i + 1, vtx_offset);
-    data.vtx[2] = data.LoadVertexData<glm::vec3>(i + 2, vtx_offset);
-    DrawTriangle(data);
+  data.defer_shading =
+      visibility_buffer_enabled_ && CanDeferShading(*pipeline);
+  data.shade_fragments =
+      GetShadeFragmentsProcs(*pipeline, data.defer_shading);
+
+  //----------------------------------------------------------------------------
+  // Process batches of primitives concurrently. Small draws are processed on
+  // this thread.
+  //----------------------------------------------------------------------------
+  const auto batch_vertex_count = kPrimitiveBatchSize * 3u;
+  const auto batch_count =
+      (count + batch_vertex_count - 1u) / batch_vertex_count;
+  std::vector<PrimitiveBatch> batches(batch_count);
+  auto process_batch = [&](size_t batch_index) {
+    auto& batch = batches[batch_index];
+    //--------------------------------------------------------------------------
+    // Vertices of indexed draws are usually shared by neighboring primitives.
+    // Cache the results of the vertex stage so they are shaded just once.
+    //--------------------------------------------------------------------------
+    std::optional<VertexCache> cache;
+    if (data.resources->index) {
+      batch.vertex_cache = &cache.emplace(pipeline->shader->GetVaryingsSize());
+    }
+    VertexResources batch_data = data;
+    const auto begin = batch_index * batch_vertex_count;
+    const auto end = std::min(count, begin + batch_vertex_count);
+    for (size_t i = begin; i < end; i += 3) {
+      batch_data.base_vertex_id = i;
+      DrawTriangle(batch_data, batch);
+    }
+    batch.vertex_cache = nullptr;
+  };
+  if (batch_count == 1u) {
+    process_batch(0u);
+  } else {
+    marl::WaitGroup wg(batch_count);
+    for (size_t i = 0; i < batch_count; i++) {
+      marl::schedule([&process_batch, wg, i]() {
+        process_batch(i);
+        wg.done();
+      });
+    }
+    wg.wait();
+  }
+
+  //----------------------------------------------------------------------------
+  // Merge the batches in order so that primitives are shaded in the order they
+  // were submitted.
+  //----------------------------------------------------------------------------
+  for (auto& batch : batches) {
+    metrics_.Merge(batch.metrics);
+    for (auto& primitive : batch.primitives) {
+      tiler_->AddData(std::move(primitive));
+    }
   }
 }
 
@@ -511,8 +1123,116 @@ void Rasterizer::Draw(std::shared_ptr<Pipeline> pipeline,
               count, stencil_refernece);
 }
 
+//------------------------------------------------------------------------------
+/// The pipeline state the fragment stage is specialized on. The key packs the
+/// log2 of the sample count followed by a bit each for whether the shader may
+/// discard fragments, the depth test, depth writes, the stencil test, and
+/// blending. Variants that defer shading to the visibility buffer are separate
+/// as they are only used with the depth test and writes enabled.
+///
+template <size_t kKey, bool kDeferred = false>
+struct FragmentVariant {
+  static constexpr size_t kSampleCount = size_t{1} << (kKey >> 5);
+  static constexpr bool kMayDiscard = kKey & (1 << 4);
+  static constexpr bool kDepthTest = kKey & (1 << 3);
+  static constexpr bool kDepthWrite = kKey & (1 << 2);
+  static constexpr bool kStencilTest = kKey & (1 << 1);
+  static constexpr bool kBlend = kKey & (1 << 0);
+  static constexpr bool kDeferShading = kDeferred;
+  //----------------------------------------------------------------------------
+  /// Blocks and primitives can be rejected using the Hi-Z buffer if they would
+  /// fail the depth test. Not if the stencil test is enabled as the stencil
+  /// buffer is updated for fragments that fail the depth test.
+  ///
+  static constexpr bool kHiZ = kDepthTest && !kStencilTest;
+};
+
+constexpr size_t kSampleCountVariants =
+    std::countr_zero(GetSampleCount(SampleCount::kSixteen)) + 1;
+
+constexpr size_t kFragmentVariantCount = kSampleCountVariants << 5;
+
+//------------------------------------------------------------------------------
+/// Get the key of the variant of the fragment stage for the state of the
+/// pipeline. Without the sample count which is only known once the draw is
+/// shaded.
+///
+static size_t GetFragmentVariantKey(const Pipeline& pipeline) {
+  const bool depth_test = pipeline.depth_desc.depth_test_enabled;
+  const bool depth_write =
+      depth_test && pipeline.depth_desc.depth_write_enabled;
+  const bool stencil_test = pipeline.stencil_desc.stencil_test_enabled;
+  const bool blend = IsBlendEnabled(pipeline);
+  const bool may_discard = pipeline.shader->MayDiscard();
+  return (may_discard << 4) |   //
+         (depth_test << 3) |    //
+         (depth_write << 2) |   //
+         (stencil_test << 1) |  //
+         (blend << 0);
+}
+
+const ShadeFragmentsProc* Rasterizer::GetShadeFragmentsProcs(
+    const Pipeline& pipeline,
+    bool defer_shading) const {
+  if (defer_shading) {
+    static constexpr size_t kDeferredKey = (1 << 3) | (1 << 2);
+    static constexpr auto kDeferredProcs =
+        []<size_t... kLog2SampleCounts>(
+            std::index_sequence<kLog2SampleCounts...>) {
+          return std::array<ShadeFragmentsProc, sizeof...(kLog2SampleCounts)>{
+              &ShadeFragmentsVariant<FragmentVariant<
+                  (kLog2SampleCounts << 5) | kDeferredKey, true>>...};
+        }(std::make_index_sequence<kSampleCountVariants>{});
+    return kDeferredProcs.data();
+  }
+  //----------------------------------------------------------------------------
+  // The variants of the same key for each sample count are adjacent.
+  //----------------------------------------------------------------------------
+  static constexpr auto kProcs =
+      []<size_t... kIndices>(std::index_sequence<kIndices...>) {
+        return std::array<ShadeFragmentsProc, sizeof...(kIndices)>{
+            &ShadeFragmentsVariant<FragmentVariant<
+                ((kIndices % kSampleCountVariants) << 5) |
+                (kIndices / kSampleCountVariants)>>...};
+      }(std::make_index_sequence<kFragmentVariantCount>{});
+  return kProcs.data() +
+         GetFragmentVariantKey(pipeline) * kSampleCountVariants;
+}
+
+marl::Event Rasterizer::Submit() {
+  //----------------------------------------------------------------------------
+  // The attachments are shared by all frames. Only one may be in flight.
+  //----------------------------------------------------------------------------
+  Wait();
+  std::swap(tiler_, submitted_tiler_);
+  tiler_->Reset();
+  frame_completed_.clear();
+  const auto clear_color = std::exchange(clear_color_, std::nullopt);
+  marl::schedule([this, clear_color, frame_completed = frame_completed_]() {
+    if (clear_color.has_value()) {
+      pass_.colors.front().clear_color = clear_color.value();
+      pass_.Load();
+    }
+    submitted_tiler_->Dispatch(*this, frame_metrics_);
+    // The depth written by the frame was discarded with the tiles. The Hi-Z
+    // buffer no longer summarizes the depth texture.
+    if (!pass_.depth.ShouldStore()) {
+      pass_.depth.hi_z.Invalidate();
+    }
+    frame_completed.signal();
+  });
+  return frame_completed_;
+}
+
+void Rasterizer::Wait() {
+  frame_completed_.wait();
+  metrics_.Merge(frame_metrics_);
+  frame_metrics_.Reset();
+}
+
 void Rasterizer::Finish() {
-  tiler_.Dispatch(*this);
+  Submit();
+  Wait();
 }
 
 }  // namespace sft
@@ -10,15 +10,19 @@
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <optional>
 
 #include "buffer.h"
 #include "buffer_view.h"
 #include "geometry.h"
+#include "marl/event.h"
 #include "pipeline.h"
+#include "pixel_block.h"
 #include "rasterizer_metrics.h"
 #include "render_pass.h"
 #include "stage_resources.h"
 #include "texture.h"
+#include "tile_buffer.h"
 #include "tiler.h"
 
 namespace sft {
@@ -31,12 +35,64 @@ class Rasterizer {
 
   ~Rasterizer();
 
+  //----------------------------------------------------------------------------
+  /// @brief      Get the attachments of the render pass. Waits for the
+  ///             submitted frame as it may still be rendering to them. Then
+  ///             writes the clears still pending in the tiles of the stored
+  ///             attachments to their textures. Meant for reading back the
+  ///             attachments. Use the accessors below to configure them every
+  ///             frame without waiting.
+  ///
   RenderPassAttachments& GetRenderPassAttachments();
 
   glm::ivec2 GetSize() const;
 
+  //----------------------------------------------------------------------------
+  /// @brief      Get the sample count of the attachments. Does not wait for
+  ///             the submitted frame.
+  ///
+  SampleCount GetSampleCount() const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the number of color attachments. Does not wait for the
+  ///             submitted frame.
+  ///
+  size_t GetColorAttachmentCount() const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Add or remove color attachments past the first. Only waits
+  ///             for the submitted frame if the count changes.
+  ///
+  [[nodiscard]] bool SetColorAttachmentCount(size_t count);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Clear the first color attachment to the color and discard the
+  ///             draws recorded so far. The other color attachments are
+  ///             cleared to their own clear colors. The attachments are
+  ///             cleared a tile at a time as the frame is shaded. Tiles without
+  ///             primitives are only cleared once the attachments are read
+  ///             back.
+  ///
   void Clear(Color color);
 
+  //----------------------------------------------------------------------------
+  /// @brief      Start shading the draws recorded so far in the background and
+  ///             return a fence that is signalled once they are done. Draws for
+  ///             the next frame may be recorded meanwhile. Only one frame is
+  ///             in flight at a time, so this first waits for the previously
+  ///             submitted one.
+  ///
+  marl::Event Submit();
+
+  //----------------------------------------------------------------------------
+  /// @brief      Wait for the submitted frame to be shaded. The attachments and
+  ///             the metrics of its fragment stage may be accessed after.
+  ///
+  void Wait();
+
+  //----------------------------------------------------------------------------
+  /// @brief      Submit the recorded draws and wait for them to be shaded.
+  ///
   void Finish();
 
   void Draw(std::shared_ptr<Pipeline> pipeline,
@@ -58,38 +114,167 @@ class Rasterizer {
 
   [[nodiscard]] bool Resize(glm::ivec2 size);
 
+  //----------------------------------------------------------------------------
+  /// @brief      Change the sample count of the attachments. Only waits for
+  ///             the submitted frame if the sample count changes. Draws
+  ///             recorded before are shaded with the new sample count.
+  ///
   [[nodiscard]] bool ResizeSamples(SampleCount count);
 
-  void ShadeFragments(const FragmentResources& tiler_data, const Rect& tile);
+  //----------------------------------------------------------------------------
+  /// @brief      Enable or disable deferring the shading of opaque draws that
+  ///             perform and write the depth test. These only write the depth
+  ///             and ID of their primitives into a visibility buffer. Then each
+  ///             pixel is shaded just once for the primitive visible in it
+  ///             regardless of the order of the draws. Takes effect for the
+  ///             draws that follow.
+  ///
+  void SetVisibilityBufferEnabled(bool enabled);
+
+  bool IsVisibilityBufferEnabled() const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Copy the attachments within the tile into its buffers. Before
+  ///             any fragments in the tile are shaded.
+  ///
+  void LoadTile(Tile& tile) const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write the buffers of the tile back to the attachments whose
+  ///             contents are stored. After all fragments in the tile are
+  ///             shaded.
+  ///
+  void StoreTile(const Tile& tile);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Note that all of the tile of the grid containing the pixel has
+  ///             been stored. Once all tasks shading parts of it are done.
+  ///
+  void MarkTileStored(glm::ivec2 pixel);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Shade the fragments of a primitive within the tile.
+  ///
+  void ShadeFragments(const FragmentResources& tiler_data, Tile& tile);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Shade the fragments in the visibility buffer of the tile and
+  ///             empty it.
+  ///
+  void ShadeVisibleFragments(Tile& tile);
 
  private:
   RenderPassAttachments pass_;
   glm::ivec2 size_;
   RasterizerMetrics metrics_;
-  Tiler tiler_;
+  //----------------------------------------------------------------------------
+  /// The metrics collected while shading the submitted frame. Merged from those
+  /// of each tile and added to the others once it is done.
+  ///
+  RasterizerMetrics frame_metrics_;
+  //----------------------------------------------------------------------------
+  /// Draws are recorded into one tiler while those in the other are shaded.
+  ///
+  std::unique_ptr<Tiler> tiler_;
+  std::unique_ptr<Tiler> submitted_tiler_;
+  std::optional<Color> clear_color_;
+  marl::Event frame_completed_{marl::Event::Mode::Manual, true};
+  bool visibility_buffer_enabled_ = false;
 
-  bool FragmentPassesDepthTest(const Pipeline& pipeline,
-                               glm::ivec2 pos,
-                               ScalarF depth,
-                               size_t sample) const;
+  LaneMask FragmentPassesDepthTest(const Pipeline& pipeline,
+                                   glm::ivec2 origin,
+                                   LaneMask mask,
+                                   const Lanes<ScalarF>& depth,
+                                   size_t sample,
+                                   const Tile& tile) const;
 
-  bool UpdateAndCheckFragmentPassesStencilTest(const Pipeline& pipeline,
-                                               glm::ivec2 pos,
-                                               bool depth_test_passes,
-                                               uint32_t reference_value,
-                                               size_t sample);
+  LaneMask FragmentPassesStencilTest(const Pipeline& pipeline,
+                                     glm::ivec2 origin,
+                                     LaneMask mask,
+                                     uint32_t reference_value,
+                                     size_t sample,
+                                     const Tile& tile) const;
 
+  void UpdateStencil(const Pipeline& pipeline,
+                     glm::ivec2 origin,
+                     LaneMask mask,
+                     LaneMask depth_test_passes,
+                     LaneMask stencil_test_passes,
+                     uint32_t reference_value,
+                     size_t sample,
+                     Tile& tile);
+
+  template <bool kBlend>
   void UpdateColor(const ColorAttachmentDescriptor& color_desc,
                    const glm::ivec2& pos,
                    const Color& color,
-                   size_t sample);
+                   size_t sample,
+                   CompressedTileBuffer<Color>& buffer);
 
-  void UpdateDepth(const DepthAttachmentDescriptor& depth_desc,
-                   const glm::ivec2& pos,
-                   ScalarF depth,
-                   size_t sample);
+  //----------------------------------------------------------------------------
+  /// @brief      Update the color of all samples of the pixel at once. Keeps
+  ///             the pixel compressed in the tile buffer if it is.
+  ///
+  template <bool kBlend>
+  void UpdatePixelColor(const ColorAttachmentDescriptor& color_desc,
+                        const glm::ivec2& pos,
+                        const Color& color,
+                        CompressedTileBuffer<Color>& buffer);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the variants of the fragment stage specialized for the
+  ///             state of the pipeline. One for each sample count, indexed by
+  ///             its base-2 logarithm. Selected once when a draw is recorded.
+  ///             The variant for the sample count of the render pass is picked
+  ///             when it is shaded as it may change in between.
+  ///
+  const ShadeFragmentsProc* GetShadeFragmentsProcs(const Pipeline& pipeline,
+                                                   bool defer_shading) const;
+
+  template <class Variant>
+  static void ShadeFragmentsVariant(Rasterizer& rasterizer,
+                                    const FragmentResources& tiler_data,
+                                    Tile& tile);
+
+  template <class Variant>
+  void ShadeFragments(const FragmentResources& tiler_data, Tile& tile);
+
+  template <class Variant>
+  void ShadeBlock(const FragmentResources& tiler_data,
+                  const PixelBlockSetup& setup,
+                  glm::ivec2 origin,
+                  const FixedPoint3& block_values,
+                  LaneMask mask,
+                  bool inside,
+                  Tile& tile);
+
+  template <class Variant>
+  void ShadeCoarseBlock(const FragmentResources& tiler_data,
+                        const PixelBlockSetup& setup,
+                        glm::ivec2 coarse_origin,
+                        const FixedPoint3& coarse_values,
+                        BlockCoverage coarse_coverage,
+                        glm::ivec2 min,
+                        glm::ivec2 max,
+                        Tile& tile);
+
+  struct PrimitiveBatch;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the clip-space position of a vertex and store its
+  ///             varyings. From the cache if it has been shaded before.
+  ///
+  glm::vec4 ShadeVertex(const VertexResources& data,
+                        FragmentResources& tiler_data,
+                        size_t vertex_id,
+                        PrimitiveBatch& batch) const;
+
+  void DrawTriangle(const VertexResources& data, PrimitiveBatch& batch) const;
 
-  void DrawTriangle(const VertexResources& data);
+  void SetupTriangle(FragmentResources tiler_data,
+                     const std::array<glm::vec4, 3>& clip,
+                     const glm::ivec2& viewport,
+                     PrimitiveBatch& batch) const;
 
   SFT_DISALLOW_COPY_AND_ASSIGN(Rasterizer);
 };
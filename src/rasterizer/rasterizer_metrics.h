@@ -18,14 +18,61 @@ struct RasterizerMetrics {
   size_t primitive_count = 0;
   size_t primitives_processed = 0;
   size_t face_culling = 0;
+  size_t clip_culling = 0;
+  size_t clipped_primitives = 0;
   size_t empty_primitive = 0;
   size_t scissor_culling = 0;
   size_t sample_point_culling = 0;
+  size_t coarse_blocks_rejected = 0;
+  size_t coarse_blocks_accepted = 0;
+  size_t hi_z_culled_primitives = 0;
+  size_t hi_z_culled_blocks = 0;
   size_t early_fragment_test = 0;
   size_t vertex_invocations = 0;
+  size_t vertex_cache_hits = 0;
   size_t fragment_invocations = 0;
+  size_t discarded_fragments = 0;
 
   void Reset() { std::memset(this, 0, sizeof(RasterizerMetrics)); }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Add the counters of metrics collected elsewhere, say by
+  ///             another thread, to these. The area is left unchanged.
+  ///
+  void Merge(const RasterizerMetrics& other) {
+    draw_count += other.draw_count;
+    primitive_count += other.primitive_count;
+    primitives_processed += other.primitives_processed;
+    face_culling += other.face_culling;
+    clip_culling += other.clip_culling;
+    clipped_primitives += other.clipped_primitives;
+    empty_primitive += other.empty_primitive;
+    scissor_culling += other.scissor_culling;
+    sample_point_culling += other.sample_point_culling;
+    coarse_blocks_rejected += other.coarse_blocks_rejected;
+    coarse_blocks_accepted += other.coarse_blocks_accepted;
+    hi_z_culled_primitives += other.hi_z_culled_primitives;
+    hi_z_culled_blocks += other.hi_z_culled_blocks;
+    early_fragment_test += other.early_fragment_test;
+    vertex_invocations += other.vertex_invocations;
+    vertex_cache_hits += other.vertex_cache_hits;
+    fragment_invocations += other.fragment_invocations;
+    discarded_fragments += other.discarded_fragments;
+  }
+};
+
+//------------------------------------------------------------------------------
+/// The size of a cache line. Counters updated by different threads are kept
+/// this far apart so they never share one.
+///
+constexpr size_t kCacheLineSize = 64;
+
+//------------------------------------------------------------------------------
+/// @brief      The metrics counted by a single task. These are merged once all
+///             tasks are done instead of every task updating shared counters.
+///
+struct alignas(kCacheLineSize) RasterizerMetricsShard {
+  RasterizerMetrics metrics;
 };
 
 }  // namespace sft
@@ -5,11 +5,18 @@
 
 #pragma once
 
+#include <memory>
+#include <variant>
+#include <vector>
+
 #include "geometry.h"
+#include "hi_z_buffer.h"
 #include "macros.h"
 #include "marl/scheduler.h"
 #include "marl/waitgroup.h"
+#include "pixel_format.h"
 #include "texture.h"
+#include "tile_buffer.h"
 
 namespace sft {
 
@@ -22,6 +29,12 @@ enum class LoadAction {
 enum class StoreAction {
   kDontCare,
   kStore,
+  //----------------------------------------------------------------------------
+  /// Resolve the samples of each tile into the resolve texture as soon as the
+  /// tile is shaded. The samples themselves are discarded.
+  ///
+  kMultisampleResolve,
+  kStoreAndMultisampleResolve,
 };
 
 struct PassAttachment {
@@ -30,6 +43,15 @@ struct PassAttachment {
 
   virtual glm::ivec2 GetSize() const = 0;
 
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the contents of the texture are written back once
+  ///             shaded.
+  ///
+  virtual bool ShouldStore() const {
+    return store_action == StoreAction::kStore ||
+           store_action == StoreAction::kStoreAndMultisampleResolve;
+  }
+
   virtual bool IsValid() const = 0;
 
   virtual void Load() = 0;
@@ -37,19 +59,134 @@ struct PassAttachment {
   virtual void Store() = 0;
 };
 
+//------------------------------------------------------------------------------
+/// @brief      The texture shaded into and the single sampled texture it is
+///             resolved into if it is multisampled. Both are in the same pixel
+///             format.
+///
+template <class Pixel>
+struct ColorTextures {
+  using PixelType = Pixel;
+
+  std::shared_ptr<Texture<Pixel>> texture;
+  std::shared_ptr<Texture<Pixel>> resolve;
+
+  ColorTextures(glm::ivec2 size, SampleCount sample_count) {
+    if (sample_count == SampleCount::kOne) {
+      // Presented as is. So it must be linear.
+      texture = std::make_shared<Texture<Pixel>>(size, sample_count);
+    } else {
+      // Only ever read back through the resolve texture.
+      texture = std::make_shared<Texture<Pixel>>(size, sample_count,
+                                                 TextureLayout::kBlockLinear);
+      resolve = std::make_shared<Texture<Pixel>>(size, SampleCount::kOne);
+    }
+  }
+};
+
 struct ColorPassAttachment final : public PassAttachment {
   glm::vec4 clear_color = {0.0, 0.0, 0.0, 1.0};
-  std::shared_ptr<Texture<Color>> texture;
-  std::shared_ptr<Texture<Color>> resolve;
+  TileClearState<Color> clear_state;
+  TileClearState<Color> resolve_clear_state;
+
+  ColorPassAttachment(glm::ivec2 size, SampleCount sample_count)
+      : textures_(ColorTextures<Color>(size, sample_count)) {
+    store_action = StoreAction::kMultisampleResolve;
+    clear_state.Resize(size);
+    resolve_clear_state.Resize(size);
+  }
+
+  glm::ivec2 GetSize() const override {
+    return std::visit(
+        [](const auto& textures) { return textures.texture->GetSize(); },
+        textures_);
+  }
 
-  ColorPassAttachment(glm::ivec2 size, SampleCount sample_count) {
-    texture = std::make_shared<Texture<Color>>(size, sample_count);
-    if (sample_count != SampleCount::kOne) {
-      resolve = std::make_shared<Texture<Color>>(size, SampleCount::kOne);
+  SampleCount GetSampleCount() const {
+    return std::visit(
+        [](const auto& textures) {
+          return textures.texture->GetSampleCount();
+        },
+        textures_);
+  }
+
+  PixelFormat GetPixelFormat() const {
+    return std::visit(
+        [](const auto& textures) {
+          using Pixel = typename std::decay_t<decltype(textures)>::PixelType;
+          return PixelFormatTraits<Pixel>::kFormat;
+        },
+        textures_);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the texture shaded into if the attachment is in the pixel
+  ///             format of the pixel type. Null otherwise.
+  ///
+  template <class Pixel>
+  std::shared_ptr<Texture<Pixel>> GetTexture() const {
+    const auto* textures = std::get_if<ColorTextures<Pixel>>(&textures_);
+    return textures ? textures->texture : nullptr;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the texture multisampled textures are resolved into if
+  ///             the attachment is in the pixel format of the pixel type. Null
+  ///             otherwise.
+  ///
+  template <class Pixel>
+  std::shared_ptr<Texture<Pixel>> GetResolveTexture() const {
+    const auto* textures = std::get_if<ColorTextures<Pixel>>(&textures_);
+    return textures ? textures->resolve : nullptr;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Replace the textures with ones in the pixel format. Their
+  ///             contents are undefined till cleared or shaded.
+  ///
+  [[nodiscard]] bool SetPixelFormat(PixelFormat format) {
+    if (!IsValid()) {
+      return false;
     }
+    const auto size = GetSize();
+    const auto sample_count = GetSampleCount();
+    switch (format) {
+      case PixelFormat::kR8G8B8A8UNormInt:
+        textures_ = ColorTextures<Color>(size, sample_count);
+        break;
+      case PixelFormat::kR5G6B5UNormInt:
+        textures_ = ColorTextures<ColorR5G6B5>(size, sample_count);
+        break;
+      case PixelFormat::kR8G8UNormInt:
+        textures_ = ColorTextures<ColorR8G8>(size, sample_count);
+        break;
+      case PixelFormat::kR8UNormInt:
+        textures_ = ColorTextures<ColorR8>(size, sample_count);
+        break;
+    }
+    return IsValid();
   }
 
-  glm::ivec2 GetSize() const override { return texture->GetSize(); }
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the samples of the texture are written back. Single
+  ///             sampled textures have nothing to resolve and are written back
+  ///             in place of the resolve texture.
+  ///
+  bool ShouldStore() const override {
+    return PassAttachment::ShouldStore() ||
+           (!HasResolveTexture() &&
+            store_action == StoreAction::kMultisampleResolve);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the samples of the texture are resolved into the
+  ///             resolve texture once shaded.
+  ///
+  bool ShouldResolve() const {
+    return HasResolveTexture() &&
+           (store_action == StoreAction::kMultisampleResolve ||
+            store_action == StoreAction::kStoreAndMultisampleResolve);
+  }
 
   [[nodiscard]] bool Resize(const glm::ivec2& size) {
     if (!IsValid()) {
@@ -58,29 +195,100 @@ struct ColorPassAttachment final : public PassAttachment {
     if (size == GetSize()) {
       return true;
     }
-    {
-      if (resolve && !resolve->Resize(size)) {
-        return false;
-      }
+    const auto resized = std::visit(
+        [&](auto& textures) {
+          if (textures.resolve && !textures.resolve->Resize(size)) {
+            return false;
+          }
+          return textures.texture->Resize(size);
+        },
+        textures_);
+    if (!resized) {
+      return false;
     }
-    return texture->Resize(size);
+    clear_state.Resize(size);
+    resolve_clear_state.Resize(size);
+    return true;
   }
 
   [[nodiscard]] bool SetSampleCount(SampleCount count) {
     if (!IsValid()) {
       return false;
     }
-    return texture->UpdateSampleCount(count);
+    return std::visit(
+        [&](auto& textures) {
+          using Pixel = typename std::decay_t<decltype(textures)>::PixelType;
+          if (count == SampleCount::kOne) {
+            textures.resolve.reset();
+          } else if (!textures.resolve) {
+            textures.resolve = std::make_shared<Texture<Pixel>>(
+                textures.texture->GetSize(), SampleCount::kOne);
+          }
+          return textures.texture->UpdateSampleCount(count);
+        },
+        textures_);
   }
 
   bool IsValid() const override {
-    if (!texture) {
-      return false;
+    return std::visit(
+        [](const auto& textures) {
+          if (!textures.texture) {
+            return false;
+          }
+          if (textures.texture->GetSampleCount() != SampleCount::kOne) {
+            return textures.resolve &&
+                   textures.resolve->GetSampleCount() == SampleCount::kOne;
+          }
+          return true;
+        },
+        textures_);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Copy the attachment within the half-open range from min to
+  ///             max into the tile buffer. Unpacked into 8-bit RGBA colors.
+  ///
+  void LoadTile(CompressedTileBuffer<Color>& buffer,
+                glm::ivec2 min,
+                glm::ivec2 max) const {
+    std::visit(
+        [&](const auto& textures) {
+          buffer.Setup(min, max, textures.texture->GetSampleCount());
+          buffer.Load(*textures.texture, clear_state);
+        },
+        textures_);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write back or resolve the tile buffer according to the store
+  ///             action. Packed into the pixel format of the attachment.
+  ///
+  void StoreTile(const CompressedTileBuffer<Color>& buffer) {
+    const auto store = ShouldStore();
+    const auto resolve = ShouldResolve();
+    std::visit(
+        [&](auto& textures) {
+          if (store) {
+            buffer.Store(*textures.texture);
+          }
+          if (resolve) {
+            buffer.Resolve(*textures.resolve);
+          }
+        },
+        textures_);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Note that all of the tile of the grid containing the pixel has
+  ///             been stored or resolved.
+  ///
+  void MarkTileStored(glm::ivec2 pixel) {
+    if (ShouldStore()) {
+      clear_state.MarkStored(pixel);
     }
-    if (texture->GetSampleCount() != SampleCount::kOne) {
-      return resolve && resolve->GetSampleCount() == SampleCount::kOne;
+    if (ShouldResolve()) {
+      resolve_clear_state.MarkStored(pixel);
     }
-    return true;
   }
 
   void Load() override {
@@ -89,20 +297,54 @@ struct ColorPassAttachment final : public PassAttachment {
       case LoadAction::kLoad:
         break;
       case LoadAction::kClear:
-        texture->Clear(clear_color);
+        clear_state.Clear(clear_color);
+        resolve_clear_state.Clear(clear_color);
         break;
     }
   }
 
-  void Store() override {}
+  //----------------------------------------------------------------------------
+  /// @brief      Write the clears still pending in tiles. The resolve of a
+  ///             cleared tile is the clear color.
+  ///
+  void Store() override {
+    const auto store = ShouldStore();
+    const auto resolve = ShouldResolve();
+    std::visit(
+        [&](auto& textures) {
+          if (store) {
+            clear_state.Store(*textures.texture);
+          }
+          if (resolve) {
+            resolve_clear_state.Store(*textures.resolve);
+          }
+        },
+        textures_);
+  }
+
+ private:
+  std::variant<ColorTextures<Color>,
+               ColorTextures<ColorR5G6B5>,
+               ColorTextures<ColorR8G8>,
+               ColorTextures<ColorR8>>
+      textures_;
+
+  bool HasResolveTexture() const {
+    return std::visit(
+        [](const auto& textures) { return !!textures.resolve; }, textures_);
+  }
 };
 
 struct DepthPassAttachment : public PassAttachment {
   ScalarF clear_depth = 1.0;
   std::shared_ptr<Texture<ScalarF>> texture;
+  HiZBuffer hi_z;
+  TileClearState<ScalarF> clear_state;
 
-  DepthPassAttachment(const glm::ivec2& size) {
-    texture = std::make_shared<Texture<ScalarF>>(size);
+  DepthPassAttachment(const glm::ivec2& size) : hi_z(size) {
+    texture = std::make_shared<Texture<ScalarF>>(size, SampleCount::kOne,
+                                                 TextureLayout::kBlockLinear);
+    clear_state.Resize(size);
   }
 
   glm::ivec2 GetSize() const override { return texture->GetSize(); }
@@ -116,13 +358,19 @@ struct DepthPassAttachment : public PassAttachment {
     if (size == GetSize()) {
       return true;
     }
-    return texture->Resize(size);
+    if (!texture->Resize(size)) {
+      return false;
+    }
+    hi_z.Resize(size);
+    clear_state.Resize(size);
+    return true;
   }
 
   [[nodiscard]] bool SetSampleCount(SampleCount count) {
     if (!IsValid()) {
       return false;
     }
+    hi_z.Invalidate();
     return texture->UpdateSampleCount(count);
   }
 
@@ -130,22 +378,31 @@ struct DepthPassAttachment : public PassAttachment {
     switch (load_action) {
       case LoadAction::kDontCare:
       case LoadAction::kLoad:
+        hi_z.Invalidate();
         break;
       case LoadAction::kClear:
-        texture->Clear(clear_depth);
+        clear_state.Clear(clear_depth);
+        hi_z.Clear(clear_depth);
         break;
     }
   }
 
-  void Store() override {}
+  void Store() override {
+    if (ShouldStore()) {
+      clear_state.Store(*texture);
+    }
+  }
 };
 
 struct StencilPassAttachment : public PassAttachment {
   uint32_t clear_stencil = 0;
   std::shared_ptr<Texture<uint8_t>> texture;
+  TileClearState<uint8_t> clear_state;
 
   StencilPassAttachment(const glm::ivec2& size) {
-    texture = std::make_shared<Texture<uint8_t>>(size);
+    texture = std::make_shared<Texture<uint8_t>>(size, SampleCount::kOne,
+                                                 TextureLayout::kBlockLinear);
+    clear_state.Resize(size);
   }
 
   glm::ivec2 GetSize() const override { return texture->GetSize(); }
@@ -159,7 +416,11 @@ struct StencilPassAttachment : public PassAttachment {
     if (size == GetSize()) {
       return true;
     }
-    return texture->Resize(size);
+    if (!texture->Resize(size)) {
+      return false;
+    }
+    clear_state.Resize(size);
+    return true;
   }
 
   [[nodiscard]] bool SetSampleCount(SampleCount count) {
@@ -175,54 +436,107 @@ struct StencilPassAttachment : public PassAttachment {
       case LoadAction::kLoad:
         break;
       case LoadAction::kClear:
-        texture->Clear(clear_stencil);
+        clear_state.Clear(clear_stencil);
         break;
     }
   }
 
-  void Store() override {}
+  void Store() override {
+    if (ShouldStore()) {
+      clear_state.Store(*texture);
+    }
+  }
 };
 
 struct RenderPassAttachments {
-  ColorPassAttachment color;
+  //----------------------------------------------------------------------------
+  /// The color attachments by location. There is always at least one. All are
+  /// the same size and have the same sample count.
+  ///
+  std::vector<ColorPassAttachment> colors;
   DepthPassAttachment depth;
   StencilPassAttachment stencil;
 
   RenderPassAttachments(const glm::ivec2& size, SampleCount sample_count)
-      : color(size, sample_count), depth(size), stencil(size) {}
+      : depth(size), stencil(size) {
+    colors.emplace_back(size, sample_count);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Add or remove color attachments past the first. Added ones
+  ///             are 8-bit RGBA and match the size and sample count of the
+  ///             first. Their contents are undefined till cleared or shaded.
+  ///
+  [[nodiscard]] bool SetColorAttachmentCount(size_t count) {
+    if (count == 0 || count > kMaxColorAttachments || !IsValid()) {
+      return false;
+    }
+    const auto size = colors.front().GetSize();
+    const auto sample_count = colors.front().GetSampleCount();
+    if (count < colors.size()) {
+      colors.erase(colors.begin() + count, colors.end());
+    }
+    while (colors.size() < count) {
+      colors.emplace_back(size, sample_count);
+    }
+    return IsValid();
+  }
 
   [[nodiscard]] bool Resize(const glm::ivec2& size) {
-    return color.Resize(size) && depth.Resize(size) && stencil.Resize(size);
+    for (auto& color : colors) {
+      if (!color.Resize(size)) {
+        return false;
+      }
+    }
+    return depth.Resize(size) && stencil.Resize(size);
   }
 
   [[nodiscard]] bool SetSampleCount(SampleCount count) {
-    return color.SetSampleCount(count) && depth.SetSampleCount(count) &&
-           stencil.SetSampleCount(count);
+    for (auto& color : colors) {
+      if (!color.SetSampleCount(count)) {
+        return false;
+      }
+    }
+    return depth.SetSampleCount(count) && stencil.SetSampleCount(count);
   }
 
   glm::ivec2 GetSize() const {
-    if (!color.IsValid()) {
+    if (colors.empty() || !colors.front().IsValid()) {
       return {};
     }
-    return color.GetSize();
+    return colors.front().GetSize();
+  }
+
+  SampleCount GetSampleCount() const {
+    return colors.front().GetSampleCount();
   }
 
   bool IsValid() const {
-    if (!color.IsValid() || !depth.IsValid() || !stencil.IsValid()) {
+    if (colors.empty() || colors.size() > kMaxColorAttachments ||
+        !depth.IsValid() || !stencil.IsValid()) {
       return false;
     }
-    const auto texture_size = color.texture->GetSize();
+    const auto texture_size = colors.front().GetSize();
+    const auto sample_count = colors.front().GetSampleCount();
+    for (const auto& color : colors) {
+      if (!color.IsValid() || color.GetSize() != texture_size ||
+          color.GetSampleCount() != sample_count) {
+        return false;
+      }
+    }
     const auto depth_size = depth.texture->GetSize();
     const auto stencil_size = stencil.texture->GetSize();
     return texture_size == depth_size && texture_size == stencil_size;
   }
 
   bool Load() {
-    marl::WaitGroup wg(3);
-    marl::schedule([wg, attachment = &color]() {
-      attachment->Load();
-      wg.done();
-    });
+    marl::WaitGroup wg(colors.size() + 2);
+    for (auto& color : colors) {
+      marl::schedule([wg, attachment = &color]() {
+        attachment->Load();
+        wg.done();
+      });
+    }
     marl::schedule([wg, attachment = &depth]() {
       attachment->Load();
       wg.done();
@@ -236,7 +550,9 @@ struct RenderPassAttachments {
   }
 
   bool Store() {
-    color.Store();
+    for (auto& color : colors) {
+      color.Store();
+    }
     depth.Store();
     stencil.Store();
     return true;
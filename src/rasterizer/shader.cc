@@ -4,3 +4,34 @@
  */
 
 #include "shader.h"
+
+#include "invocation.h"
+
+namespace sft {
+
+std::vector<Interpolation> Shader::GetVaryingInterpolation() const {
+  std::vector<Interpolation> interpolation(GetVaryingsSize() / sizeof(ScalarF),
+                                           Interpolation::kPerspective);
+  for (const auto& varying : GetVaryingDescriptors()) {
+    const auto begin = varying.offset / sizeof(ScalarF);
+    const auto end = (varying.offset + varying.size) / sizeof(ScalarF);
+    for (auto i = begin; i < end && i < interpolation.size(); i++) {
+      interpolation[i] = varying.interpolation;
+    }
+  }
+  return interpolation;
+}
+
+void Shader::ProcessFragmentBatch(FragmentBatch& batch) const {
+  for (size_t i = 0; i < batch.GetCount(); i++) {
+    const auto inv = batch.GetInvocation(i);
+    const auto color = ProcessFragment(inv);
+    if (inv.IsDiscarded()) {
+      batch.Discard(i);
+    } else {
+      batch.StoreColor(i, color);
+    }
+  }
+}
+
+}  // namespace sft
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 
 #include "geometry.h"
 
@@ -13,6 +14,7 @@ namespace sft {
 
 struct VertexInvocation;
 struct FragmentInvocation;
+struct FragmentBatch;
 
 #define VTX(struct_member)                                 \
   inv.LoadVertexData<decltype(VertexData::struct_member)>( \
@@ -30,6 +32,31 @@ struct FragmentInvocation;
 #define FORWARD(vtx_member, var_member) \
   VARYING_STORE(var_member, VTX(vtx_member))
 
+#define VARYING_INTERPOLATION(member, qualifier)                \
+  VaryingDescriptor{.offset = offsetof(Varyings, member),       \
+                    .size = sizeof(decltype(Varyings::member)), \
+                    .interpolation = Interpolation::qualifier}
+
+//------------------------------------------------------------------------------
+/// How varyings are interpolated across a primitive. Like the interpolation
+/// qualifiers in GLSL.
+///
+enum class Interpolation : uint8_t {
+  /// Interpolated in a perspective-correct manner. The default.
+  kPerspective,
+  /// Interpolated linearly in screen-space.
+  kNoPerspective,
+  /// Not interpolated. The value at the first vertex of the primitive is used
+  /// for all its fragments.
+  kFlat,
+};
+
+struct VaryingDescriptor {
+  size_t offset = 0;
+  size_t size = 0;
+  Interpolation interpolation = Interpolation::kPerspective;
+};
+
 class Shader {
  public:
   Shader() = default;
@@ -38,9 +65,44 @@ class Shader {
 
   virtual size_t GetVaryingsSize() const = 0;
 
+  //----------------------------------------------------------------------------
+  /// @brief      Describe the varyings that aren't interpolated in a
+  ///             perspective-correct manner. All varyings are made up of
+  ///             floats.
+  ///
+  virtual std::vector<VaryingDescriptor> GetVaryingDescriptors() const {
+    return {};
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get how each float in the varyings is interpolated.
+  ///
+  std::vector<Interpolation> GetVaryingInterpolation() const;
+
   virtual glm::vec4 ProcessVertex(const VertexInvocation& inv) const = 0;
 
+  //----------------------------------------------------------------------------
+  /// @brief      Shade a fragment. Returns the color of the first color
+  ///             attachment.
+  ///
   virtual glm::vec4 ProcessFragment(const FragmentInvocation& inv) const = 0;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the fragment stage may discard fragments. Depth and
+  ///             stencil values of pipelines using shaders that do are only
+  ///             updated after fragments are shaded.
+  ///
+  virtual bool MayDiscard() const { return false; }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Shade all fragments in a batch and store their colors. The
+  ///             default implementation invokes `ProcessFragment` for each
+  ///             fragment. Shaders may override this to load uniforms and
+  ///             varyings once per batch and shade fragments in a loop. Shaders
+  ///             writing more than the first color attachment must override
+  ///             this and store a color for each.
+  ///
+  virtual void ProcessFragmentBatch(FragmentBatch& batch) const;
 };
 
 }  // namespace sft
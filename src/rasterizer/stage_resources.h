@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "buffer_view.h"
+#include "edge_equation.h"
 #include "geometry.h"
 #include "macros.h"
 #include "pipeline.h"
@@ -19,13 +20,31 @@
 namespace sft {
 
 class Buffer;
+class Rasterizer;
 
 struct BufferView;
+struct FragmentResources;
+struct Tile;
+
+using ShadeFragmentsProc = void (*)(Rasterizer& rasterizer,
+                                    const FragmentResources& tiler_data,
+                                    Tile& tile);
 
 struct DispatchResources {
+  //----------------------------------------------------------------------------
+  /// The pipeline as it was when the draw was recorded. Its primitives are
+  /// shaded after the frame is submitted, possibly while the next frame is
+  /// recorded with the same pipeline updated for it.
+  ///
+  Pipeline pipeline;
   BufferView vertex;
   BufferView index;
   Uniforms uniform;
+  //----------------------------------------------------------------------------
+  /// How each float in the varyings of the shader is interpolated. Looked up
+  /// once per draw.
+  ///
+  std::vector<Interpolation> varying_interpolation;
 
   template <class T>
   T LoadUniform(size_t offset) const {
@@ -36,11 +55,12 @@ struct DispatchResources {
 };
 
 struct VertexResources {
-  std::array<glm::vec3, 3> vtx;
   size_t base_vertex_id = 0;
   std::shared_ptr<Pipeline> pipeline;
   std::shared_ptr<DispatchResources> resources;
   const uint32_t stencil_reference;
+  const ShadeFragmentsProc* shade_fragments = nullptr;
+  bool defer_shading = false;
 
   VertexResources(std::shared_ptr<Pipeline> p_pipeline,
                   std::shared_ptr<DispatchResources> p_resources,
@@ -96,16 +116,49 @@ struct VertexResources {
 struct FragmentResources {
   Rect box;
   glm::vec3 ndc[3];
+  TriangleEdges edges;
   std::shared_ptr<Pipeline> pipeline;
   std::shared_ptr<DispatchResources> resources;
   uint32_t stencil_reference = 0;
+  //----------------------------------------------------------------------------
+  /// The variants of the fragment stage for the pipeline. One for each sample
+  /// count, indexed by its base-2 logarithm.
+  ///
+  const ShadeFragmentsProc* shade_fragments = nullptr;
+  //----------------------------------------------------------------------------
+  /// Primitives that defer shading only write their depth and ID to the
+  /// visibility buffer. The fragments visible at the end are shaded once.
+  ///
+  bool defer_shading = false;
+  //----------------------------------------------------------------------------
+  /// Identifies both the draw and the primitive within it. Assigned by the
+  /// tiler and never `Tile::kNoPrimitive`.
+  ///
+  uint32_t id = 0;
+  //----------------------------------------------------------------------------
+  /// The reciprocals of the clip-space w of each vertex. Perspective-correct
+  /// barycentric coordinates are only computed if these differ.
+  ///
+  glm::vec3 one_over_w = {1.0f, 1.0f, 1.0f};
+  bool perspective = false;
+  //----------------------------------------------------------------------------
+  /// The values of the varyings at each vertex as stored by the vertex stage.
+  /// Replaced by the plane equations of the varyings during triangle setup.
+  ///
   std::vector<uint8_t> varyings;
+  //----------------------------------------------------------------------------
+  /// A bit for each of the first 64 floats of the varyings that is set if it
+  /// is interpolated using perspective-correct barycentric coordinates. Set up
+  /// once per primitive so that fragments need not look it up.
+  ///
+  uint64_t perspective_varyings = 0;
 
-  explicit FragmentResources(size_t varyings_stride) {
+  explicit FragmentResources(size_t p_varyings_stride)
+      : varyings_stride(p_varyings_stride) {
     varyings.resize(varyings_stride * 3u);
   }
 
-  size_t GetVaryingsStride() const { return varyings.size() / 3u; }
+  size_t GetVaryingsStride() const { return varyings_stride; }
 
   const Image& LoadImage(size_t location) const {
     return *resources->uniform.images.at(location);
@@ -122,18 +175,114 @@ struct FragmentResources {
   }
 
   template <class T>
-  T LoadVarying(const glm::vec3& barycentric_coordinates,
-                size_t struct_offset) const {
+  std::array<T, 3> LoadVaryingVertices(size_t struct_offset) const {
     const auto stride = GetVaryingsStride();
     auto ptr = varyings.data() + struct_offset;
-    T p1, p2, p3;
-    memcpy(&p1, ptr, sizeof(p1));
+    std::array<T, 3> result;
+    memcpy(&result[0], ptr, sizeof(T));
     ptr += stride;
-    memcpy(&p2, ptr, sizeof(p2));
+    memcpy(&result[1], ptr, sizeof(T));
     ptr += stride;
-    memcpy(&p3, ptr, sizeof(p3));
-    return BarycentricInterpolation(p1, p2, p3, barycentric_coordinates);
+    memcpy(&result[2], ptr, sizeof(T));
+    return result;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Set the varyings of one vertex to those of the vertices of
+  ///             another primitive weighted by barycentric coordinates. Used
+  ///             for the vertices of clipped primitives. Flat varyings keep the
+  ///             value of the first vertex of the other primitive.
+  ///
+  void InterpolateVaryings(const FragmentResources& other,
+                           size_t vertex,
+                           const glm::vec3& weights) {
+    const auto& interpolation = resources->varying_interpolation;
+    const auto stride = GetVaryingsStride();
+    for (size_t i = 0; i < interpolation.size(); i++) {
+      const auto offset = i * sizeof(ScalarF);
+      const auto p = other.LoadVaryingVertices<ScalarF>(offset);
+      const auto value =
+          interpolation[i] == Interpolation::kFlat
+              ? p[0]
+              : weights.x * p[0] + weights.y * p[1] + weights.z * p[2];
+      memcpy(varyings.data() + stride * vertex + offset, &value,
+             sizeof(ScalarF));
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Replace the values of the varyings at each vertex with their
+  ///             plane equations in barycentric space. The value of a varying
+  ///             at barycentric coordinates `b` is then
+  ///             `p[0] + b.y * p[1] + b.z * p[2]`.
+  ///
+  /// @param[in]  w     The clip-space w of each vertex.
+  ///
+  void SetupVaryings(const glm::vec3& w) {
+    one_over_w = 1.0f / w;
+    perspective = w.x != w.y || w.x != w.z;
+    perspective_varyings = 0;
+    const auto& interpolation = resources->varying_interpolation;
+    const auto stride = GetVaryingsStride();
+    for (size_t i = 0; i < interpolation.size(); i++) {
+      if (perspective && i < 64u &&
+          interpolation[i] == Interpolation::kPerspective) {
+        perspective_varyings |= uint64_t{1} << i;
+      }
+      const auto offset = i * sizeof(ScalarF);
+      auto p = LoadVaryingVertices<ScalarF>(offset);
+      if (interpolation[i] == Interpolation::kFlat) {
+        p[1] = p[2] = 0.0f;
+      } else {
+        p[1] -= p[0];
+        p[2] -= p[0];
+      }
+      memcpy(varyings.data() + offset + stride, &p[1], sizeof(ScalarF));
+      memcpy(varyings.data() + offset + stride * 2u, &p[2], sizeof(ScalarF));
+    }
   }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the plane equation of a varying setup by `SetupVaryings`.
+  ///
+  template <class T>
+  std::array<T, 3> LoadVaryingPlane(size_t struct_offset) const {
+    return LoadVaryingVertices<T>(struct_offset);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the varying at the offset is interpolated using
+  ///             perspective-correct barycentric coordinates.
+  ///
+  bool IsPerspectiveCorrect(size_t struct_offset) const {
+    const auto index = struct_offset / sizeof(ScalarF);
+    if (index < 64u) {
+      return (perspective_varyings >> index) & 1u;
+    }
+    return perspective && resources->varying_interpolation[index] ==
+                              Interpolation::kPerspective;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Get the perspective-correct barycentric coordinates from the
+  ///             screen-space ones.
+  ///
+  SFT_ALWAYS_INLINE glm::vec3 GetPerspectiveCoordinates(
+      const glm::vec3& barycentric_coordinates) const {
+    const auto p = barycentric_coordinates * one_over_w;
+    return p * (1.0f / (p.x + p.y + p.z));
+  }
+
+  template <class T>
+  T LoadVarying(const glm::vec3& barycentric_coordinates,
+                size_t struct_offset) const {
+    const auto p = LoadVaryingPlane<T>(struct_offset);
+    return p[0] + barycentric_coordinates.y * p[1] +
+           barycentric_coordinates.z * p[2];
+  }
+
+ private:
+  size_t varyings_stride = 0;
 };
 
 }  // namespace sft
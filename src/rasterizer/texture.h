@@ -7,9 +7,11 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cstring>
 #include <limits>
 #include <type_traits>
+#include <utility>
 
 #include "geometry.h"
 #include "image.h"
@@ -83,41 +85,123 @@ constexpr glm::vec2 GetSampleLocation(SampleCount sample_count,
   return {0.5, 0.5};
 }
 
-inline Color PerformResolve2(Color a, Color b) {
-  return Color{(a.color & b.color) + (((a.color ^ b.color) >> 1) & 0x7F7F7F7F) +
-               ((a.color ^ b.color) & 0x01010101)};
+//------------------------------------------------------------------------------
+/// @brief      Average the samples of a pixel rounding to the nearest value.
+///             The even and odd channels are summed in the two halves of a
+///             32-bit word each so that all four channels are averaged at
+///             once. The halves are wide enough for the sums of 16 samples.
+///
+template <size_t kSampleCount>
+SFT_ALWAYS_INLINE Color ResolveSamples(const Color* samples) {
+  static_assert(std::has_single_bit(kSampleCount) && kSampleCount <= 16u);
+  constexpr uint32_t kChannelMask = 0x00FF00FF;
+  constexpr uint32_t kRounding = 0x00010001u * (kSampleCount / 2u);
+  constexpr auto kShift = std::countr_zero(kSampleCount);
+  uint32_t even = kRounding;
+  uint32_t odd = kRounding;
+  for (size_t i = 0; i < kSampleCount; i++) {
+    even += samples[i].color & kChannelMask;
+    odd += (samples[i].color >> 8) & kChannelMask;
+  }
+  return Color{((even >> kShift) & kChannelMask) |
+               (((odd >> kShift) & kChannelMask) << 8)};
 }
 
-inline Color PerformResolve(const Color* samples, uint8_t count) {
-  if (count == 1) {
-    return samples[0];
+//------------------------------------------------------------------------------
+/// @brief      Resolve a row of pixels whose samples are next to each other in
+///             memory. The loop over the pixels of the row is vectorized by
+///             the compiler for each sample count.
+///
+template <size_t kSampleCount>
+void ResolveRow(const Color* samples, Color* resolved, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    resolved[i] = ResolveSamples<kSampleCount>(samples + i * kSampleCount);
   }
-  auto* intermediates =
-      reinterpret_cast<Color*>(alloca(sizeof(Color) * count / 2));
-  for (size_t i = 0; i < count; i += 2) {
-    intermediates[i / 2] = PerformResolve2(samples[i], samples[i + 1]);
+}
+
+inline void ResolveRow(const Color* samples,
+                       Color* resolved,
+                       size_t count,
+                       SampleCount sample_count) {
+  switch (sample_count) {
+    case SampleCount::kOne:
+      std::memcpy(resolved, samples, count * sizeof(Color));
+      return;
+    case SampleCount::kTwo:
+      return ResolveRow<2u>(samples, resolved, count);
+    case SampleCount::kFour:
+      return ResolveRow<4u>(samples, resolved, count);
+    case SampleCount::kEight:
+      return ResolveRow<8u>(samples, resolved, count);
+    case SampleCount::kSixteen:
+      return ResolveRow<16u>(samples, resolved, count);
   }
-  return PerformResolve(intermediates, count / 2);
+}
+
+enum class TextureLayout {
+  //----------------------------------------------------------------------------
+  /// Pixels are stored a row at a time.
+  ///
+  kLinear,
+  //----------------------------------------------------------------------------
+  /// Pixels are stored in square blocks a block at a time. The pixels of each
+  /// block are stored a row at a time. Regions that fit in a block are close
+  /// together in memory and regions in different blocks never share a cache
+  /// line.
+  ///
+  kBlockLinear,
+};
+
+//------------------------------------------------------------------------------
+/// The size of the square blocks of textures with the block-linear layout.
+///
+constexpr Scalar kTextureBlockSize = 64;
+
+//------------------------------------------------------------------------------
+/// The number of bytes of a texture cleared by a single task. Large enough for
+/// the cost of scheduling to not matter and small enough for all workers to
+/// get a share of large textures.
+///
+constexpr size_t kTextureClearSpanSize = 256u * 1024u;
+
+//------------------------------------------------------------------------------
+/// @brief      Set count values to the value. Values whose bytes are all the
+///             same are filled using memset. Others in a loop the compiler
+///             vectorizes.
+///
+template <class T>
+void FillValues(T* values, size_t count, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  std::array<uint8_t, sizeof(T)> bytes;
+  std::memcpy(bytes.data(), &value, sizeof(T));
+  if (std::all_of(bytes.begin(), bytes.end(),
+                  [&](uint8_t byte) { return byte == bytes[0]; })) {
+    std::memset(values, bytes[0], count * sizeof(T));
+    return;
+  }
+  std::fill_n(values, count, value);
 }
 
 template <class T, class = std::enable_if_t<std::is_standard_layout_v<T>>>
 class Texture {
  public:
-  Texture(glm::ivec2 size, SampleCount samples = SampleCount::kOne)
-      : Texture(reinterpret_cast<T*>(
-                    std::calloc(size.x * size.y * static_cast<uint8_t>(samples),
-                                sizeof(T))),
+  Texture(glm::ivec2 size,
+          SampleCount samples = SampleCount::kOne,
+          TextureLayout layout = TextureLayout::kLinear)
+      : Texture(reinterpret_cast<T*>(std::calloc(
+                    GetAllocationLength(size, samples, layout), sizeof(T))),
                 size,
-                samples) {}
+                samples,
+                layout) {}
 
   ~Texture() { std::free(allocation_); }
 
   bool IsValid() const { return allocation_ != nullptr; }
 
   [[nodiscard]] bool Resize(glm::ivec2 size) {
-    auto new_allocation =
-        std::realloc(allocation_, size.x * size.y * sizeof(T) *
-                                      static_cast<uint8_t>(sample_count_));
+    auto new_allocation = std::realloc(
+        allocation_,
+        GetAllocationLength(size, sample_count_, layout_) * sizeof(T));
     if (!new_allocation) {
       // The old allocation is still valid. Nothing has changed.
       return false;
@@ -137,34 +221,77 @@ class Texture {
   }
 
   void Set(const T& val, glm::ivec2 pos, size_t sample_index) {
-    const auto sample_count = static_cast<uint8_t>(sample_count_);
-    const auto offset = ((size_.x * pos.y + pos.x) * sample_count) +
-                        (sample_index % sample_count);
-    std::memcpy(allocation_ + offset, &val, sizeof(T));
+    std::memcpy(allocation_ + GetOffset(pos, sample_index), &val, sizeof(T));
   }
 
   const T* Get(glm::ivec2 pos, size_t sample_index) const {
-    const auto sample_count = static_cast<uint8_t>(sample_count_);
-    const auto offset = ((size_.x * pos.y + pos.x) * sample_count) +
-                        (sample_index % sample_count);
-    return allocation_ + offset;
+    return allocation_ + GetOffset(pos, sample_index);
+  }
+
+  T* Get(glm::ivec2 pos, size_t sample_index) {
+    return const_cast<T*>(std::as_const(*this).Get(pos, sample_index));
   }
 
+  //----------------------------------------------------------------------------
+  /// @brief      Set all samples of all pixels to the value. Large textures are
+  ///             split into spans filled concurrently.
+  ///
   void Clear(const T& val) {
-    for (auto i = 0;
-         i < size_.x * size_.y * static_cast<uint8_t>(sample_count_); i++) {
-      allocation_[i] = val;
+    const auto length = GetLength();
+    const auto span = std::max<size_t>(kTextureClearSpanSize / sizeof(T), 1u);
+    if (length <= span) {
+      FillValues(allocation_, length, val);
+      return;
+    }
+    marl::WaitGroup wg;
+    for (size_t begin = 0; begin < length; begin += span) {
+      wg.add();
+      marl::schedule([&, begin]() {
+        FillValues(allocation_ + begin, std::min(span, length - begin), val);
+        wg.done();
+      });
+    }
+    wg.wait();
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Set all samples of the pixels in the half-open range from min
+  ///             to max to the value.
+  ///
+  void Clear(const T& val, glm::ivec2 min, glm::ivec2 max) {
+    const auto samples = static_cast<uint8_t>(sample_count_);
+    for (auto y = min.y; y < max.y; y++) {
+      for (auto x = min.x; x < max.x;) {
+        const auto end = GetRowSpanEnd(x, max.x);
+        FillValues(Get({x, y}, 0), (end - x) * samples, val);
+        x = end;
+      }
     }
   }
 
+  //----------------------------------------------------------------------------
+  /// @brief      Get the end of the span of pixels of a row starting at x that
+  ///             are contiguous in memory. At most max.
+  ///
+  Scalar GetRowSpanEnd(Scalar x, Scalar max) const {
+    if (layout_ == TextureLayout::kLinear) {
+      return max;
+    }
+    return std::min(max, (x / kTextureBlockSize + 1) * kTextureBlockSize);
+  }
+
   constexpr size_t GetBytesPerPixel() const { return sizeof(T); }
 
   constexpr size_t GetByteLength() const {
     return GetLength() * GetBytesPerPixel();
   }
 
+  //----------------------------------------------------------------------------
+  /// @brief      The number of values in the allocation. Textures with the
+  ///             block-linear layout are padded to a whole number of blocks.
+  ///
   constexpr size_t GetLength() const {
-    return size_.x * size_.y * static_cast<uint8_t>(sample_count_);
+    return GetAllocationLength(size_, sample_count_, layout_);
   }
 
   std::pair<T, T> GetMinMaxValue() const {
@@ -173,9 +300,11 @@ class Texture {
     }
     auto min = std::numeric_limits<T>::max();
     auto max = std::numeric_limits<T>::min();
-    for (size_t i = 0, count = GetLength(); i < count; i++) {
-      min = std::min(min, allocation_[i]);
-      max = std::max(max, allocation_[i]);
+    for (auto y = 0; y < size_.y; y++) {
+      for (auto x = 0; x < size_.x; x++) {
+        min = std::min(min, *Get({x, y}, 0));
+        max = std::max(max, *Get({x, y}, 0));
+      }
     }
     return {min, max};
   }
@@ -185,13 +314,16 @@ class Texture {
     if (sample_count_ != SampleCount::kOne) {
       return nullptr;
     }
-    const auto size = GetLength() * sizeof(Color);
+    const auto size = size_.x * size_.y * sizeof(Color);
     auto* allocation = reinterpret_cast<Color*>(std::malloc(size));
     if (!allocation) {
       return nullptr;
     }
-    for (size_t i = 0; i < GetLength(); i++) {
-      allocation[i] = transform(allocation_[i]);
+    // The image is always linear.
+    for (auto y = 0; y < size_.y; y++) {
+      for (auto x = 0; x < size_.x; x++) {
+        allocation[size_.x * y + x] = transform(*Get({x, y}, 0));
+      }
     }
     auto mapping = std::make_shared<Mapping>(
         reinterpret_cast<const uint8_t*>(allocation),  //
@@ -205,6 +337,8 @@ class Texture {
 
   SampleCount GetSampleCount() const { return sample_count_; }
 
+  TextureLayout GetLayout() const { return layout_; }
+
   [[nodiscard]] bool Resolve(Texture<T>& to) const {
     if (to.GetSize() != GetSize()) {
       return false;
@@ -213,7 +347,8 @@ class Texture {
       return false;
     }
     const auto slices = TileFactorForAvailableHardwareConcurrency();
-    glm::ivec2 span = size_ / glm::ivec2{slices, slices};
+    // Rounded up so that the last slices include the remainder.
+    glm::ivec2 span = (size_ + glm::ivec2{slices - 1}) / glm::ivec2{slices};
 
     marl::WaitGroup wg;
 
@@ -236,19 +371,55 @@ class Texture {
   T* allocation_ = nullptr;
   glm::ivec2 size_ = {};
   SampleCount sample_count_;
+  TextureLayout layout_;
+
+  Texture(T* allocation,
+          glm::ivec2 size,
+          SampleCount sample_count,
+          TextureLayout layout)
+      : allocation_(allocation),
+        size_(size),
+        sample_count_(sample_count),
+        layout_(layout) {}
+
+  static constexpr size_t GetAllocationLength(glm::ivec2 size,
+                                              SampleCount sample_count,
+                                              TextureLayout layout) {
+    if (layout == TextureLayout::kBlockLinear) {
+      size = ((size + kTextureBlockSize - 1) / kTextureBlockSize) *
+             kTextureBlockSize;
+    }
+    return size.x * size.y * static_cast<uint8_t>(sample_count);
+  }
 
-  Texture(T* allocation, glm::ivec2 size, SampleCount sample_count)
-      : allocation_(allocation), size_(size), sample_count_(sample_count) {}
+  SFT_ALWAYS_INLINE size_t GetPixelIndex(glm::ivec2 pos) const {
+    if (layout_ == TextureLayout::kLinear) {
+      return size_.x * pos.y + pos.x;
+    }
+    const auto blocks_per_row =
+        (size_.x + kTextureBlockSize - 1) / kTextureBlockSize;
+    const auto block = pos / kTextureBlockSize;
+    const auto local = pos - block * kTextureBlockSize;
+    return (blocks_per_row * block.y + block.x) * kTextureBlockSize *
+               kTextureBlockSize +
+           kTextureBlockSize * local.y + local.x;
+  }
+
+  SFT_ALWAYS_INLINE size_t GetOffset(glm::ivec2 pos,
+                                     size_t sample_index) const {
+    const auto sample_count = static_cast<uint8_t>(sample_count_);
+    return (GetPixelIndex(pos) * sample_count) + (sample_index % sample_count);
+  }
 
   void ResolveSubSection(Texture<T>& to, glm::ivec2 min, glm::ivec2 max) const {
     min = glm::max(glm::ivec2{0, 0}, min);
     max = glm::min(size_, max);
-    for (auto x = min.x; x < max.x; x++) {
-      for (auto y = min.y; y < max.y; y++) {
-        const auto position = glm::ivec2{x, y};
-        const auto* samples = Get(position, 0);
-        to.Set(PerformResolve(samples, static_cast<uint8_t>(sample_count_)),
-               position, 0);
+    for (auto y = min.y; y < max.y; y++) {
+      for (auto x = min.x; x < max.x;) {
+        const auto end =
+            std::min(GetRowSpanEnd(x, max.x), to.GetRowSpanEnd(x, max.x));
+        ResolveRow(Get({x, y}, 0), to.Get({x, y}, 0), end - x, sample_count_);
+        x = end;
       }
     }
   }
@@ -0,0 +1,12 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "tile_buffer.h"
+
+namespace sft {
+
+//
+
+}  // namespace sft
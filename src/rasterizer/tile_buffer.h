@@ -0,0 +1,454 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "attachment.h"
+#include "geometry.h"
+#include "macros.h"
+#include "marl/scheduler.h"
+#include "marl/waitgroup.h"
+#include "pixel_format.h"
+#include "rasterizer_metrics.h"
+#include "texture.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// The size of the square tiles of the fixed grid primitives are binned into.
+/// A multiple of the size of the coarse blocks and of the blocks of the Hi-Z
+/// buffer so that no two tiles ever update the same block.
+///
+constexpr Scalar kTileSize = 64;
+
+//------------------------------------------------------------------------------
+/// The rows of a tile are copied to and from textures with the block-linear
+/// layout at once. They must never straddle two blocks.
+///
+static_assert(kTextureBlockSize % kTileSize == 0);
+
+//------------------------------------------------------------------------------
+/// @brief      Tracks the tiles of an attachment that have been cleared but not
+///             written to yet. Clearing only records the value. The texture is
+///             written to when a tile is shaded or the attachment is stored.
+///
+template <class T>
+class TileClearState {
+ public:
+  TileClearState() = default;
+
+  TileClearState(TileClearState&&) = default;
+
+  ~TileClearState() = default;
+
+  TileClearState& operator=(TileClearState&&) = default;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Set the size of the attachment. The tiles of the resized
+  ///             texture are undefined and no clears are pending.
+  ///
+  void Resize(glm::ivec2 size) {
+    size_ = size;
+    grid_size_ = (size + kTileSize - 1) / kTileSize;
+    pending_.assign(grid_size_.x * grid_size_.y, false);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Clear all tiles to the value without touching the texture.
+  ///
+  void Clear(const T& value) {
+    value_ = value;
+    std::fill(pending_.begin(), pending_.end(), true);
+  }
+
+  const T& GetValue() const { return value_; }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Whether the tile containing the pixel has been cleared but
+  ///             the clear has not been written to the texture.
+  ///
+  bool IsPending(glm::ivec2 pixel) const {
+    return pending_[GetTileIndex(pixel)];
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Note that the whole of the tile containing the pixel has been
+  ///             written to the texture.
+  ///
+  void MarkStored(glm::ivec2 pixel) { pending_[GetTileIndex(pixel)] = false; }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write all pending clears to the texture. A row of tiles per
+  ///             task. Or all of the texture at once if no tile was written.
+  ///             Colors are packed into the pixel format of the texture.
+  ///
+  template <class Pixel = T>
+  void Store(Texture<Pixel>& texture) {
+    Pixel value;
+    if constexpr (std::is_same_v<Pixel, T>) {
+      value = value_;
+    } else {
+      value = PixelFormatTraits<Pixel>::Pack(value_);
+    }
+    if (std::all_of(pending_.begin(), pending_.end(),
+                    [](bool pending) { return pending; })) {
+      texture.Clear(value);
+      std::fill(pending_.begin(), pending_.end(), false);
+      return;
+    }
+    marl::WaitGroup wg(grid_size_.y);
+    for (auto y = 0; y < grid_size_.y; y++) {
+      marl::schedule([&, y]() {
+        for (auto x = 0; x < grid_size_.x; x++) {
+          if (!pending_[y * grid_size_.x + x]) {
+            continue;
+          }
+          const auto min = glm::ivec2{x, y} * kTileSize;
+          texture.Clear(value, min, glm::min(min + kTileSize, size_));
+        }
+        wg.done();
+      });
+    }
+    wg.wait();
+    // Bits of the same word may not be written concurrently.
+    std::fill(pending_.begin(), pending_.end(), false);
+  }
+
+ private:
+  glm::ivec2 size_ = {};
+  glm::ivec2 grid_size_ = {};
+  T value_ = {};
+  std::vector<bool> pending_;
+
+  size_t GetTileIndex(glm::ivec2 pixel) const {
+    const auto tile = pixel / kTileSize;
+    return grid_size_.x * tile.y + tile.x;
+  }
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(TileClearState);
+};
+
+//------------------------------------------------------------------------------
+/// @brief      A copy of the part of an attachment within a tile. It is small
+///             enough to stay in cache while the tile is shaded. Pixels are
+///             addressed by their position in the attachment and samples are
+///             laid out the same way as in a texture.
+///
+template <class T>
+class TileBuffer {
+ public:
+  TileBuffer() = default;
+
+  ~TileBuffer() = default;
+
+  bool IsValid() const { return !values_.empty(); }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Allocate storage for the pixels in the half-open range from
+  ///             min to max. The contents are undefined till they are loaded
+  ///             or cleared.
+  ///
+  void Setup(glm::ivec2 min, glm::ivec2 max, SampleCount sample_count) {
+    origin_ = min;
+    size_ = max - min;
+    sample_count_ = sample_count;
+    samples_ = static_cast<uint8_t>(sample_count);
+    values_.resize(size_.x * size_.y * samples_);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Copy the contents of the tile from the texture a row at a
+  ///             time. Or fill it with the clear value if the texture has not
+  ///             been written to since it was cleared.
+  ///
+  void Load(const Texture<T>& texture, const TileClearState<T>& clear_state) {
+    if (clear_state.IsPending(origin_)) {
+      Clear(clear_state.GetValue());
+      return;
+    }
+    const auto row_length = size_.x * samples_;
+    for (auto y = 0; y < size_.y; y++) {
+      std::memcpy(values_.data() + row_length * y,             //
+                  texture.Get(origin_ + glm::ivec2{0, y}, 0),  //
+                  row_length * sizeof(T)                       //
+      );
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write the contents of the tile back to the texture. A row at a
+  ///             time.
+  ///
+  void Store(Texture<T>& texture) const {
+    const auto row_length = size_.x * samples_;
+    for (auto y = 0; y < size_.y; y++) {
+      std::memcpy(texture.Get(origin_ + glm::ivec2{0, y}, 0),  //
+                  values_.data() + row_length * y,             //
+                  row_length * sizeof(T)                       //
+      );
+    }
+  }
+
+  void Clear(const T& value) {
+    std::fill(values_.begin(), values_.end(), value);
+  }
+
+  SFT_ALWAYS_INLINE void Set(const T& value,
+                             glm::ivec2 pos,
+                             size_t sample_index) {
+    values_[GetOffset(pos, sample_index)] = value;
+  }
+
+  SFT_ALWAYS_INLINE const T* Get(glm::ivec2 pos, size_t sample_index) const {
+    return values_.data() + GetOffset(pos, sample_index);
+  }
+
+  SFT_ALWAYS_INLINE T* Get(glm::ivec2 pos, size_t sample_index) {
+    return values_.data() + GetOffset(pos, sample_index);
+  }
+
+  glm::ivec2 GetOrigin() const { return origin_; }
+
+  glm::ivec2 GetSize() const { return size_; }
+
+  SampleCount GetSampleCount() const { return sample_count_; }
+
+ private:
+  glm::ivec2 origin_ = {};
+  glm::ivec2 size_ = {};
+  SampleCount sample_count_ = SampleCount::kOne;
+  size_t samples_ = 1u;
+  std::vector<T> values_;
+
+  SFT_ALWAYS_INLINE size_t GetOffset(glm::ivec2 pos,
+                                     size_t sample_index) const {
+    const auto local = pos - origin_;
+    return ((size_.x * local.y + local.x) * samples_) +
+           (sample_index % samples_);
+  }
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(TileBuffer);
+};
+
+//------------------------------------------------------------------------------
+/// @brief      A tile buffer for multisampled attachments that stores a single
+///             value for pixels whose samples are all the same. Most pixels
+///             away from the edges of primitives are written and read once
+///             instead of once per sample. Pixels are expanded to a value per
+///             sample when a single sample is written.
+///
+template <class T>
+class CompressedTileBuffer {
+ public:
+  CompressedTileBuffer() = default;
+
+  ~CompressedTileBuffer() = default;
+
+  bool IsValid() const { return values_.IsValid(); }
+
+  void Setup(glm::ivec2 min, glm::ivec2 max, SampleCount sample_count) {
+    values_.Setup(min, max, sample_count);
+    samples_ = static_cast<uint8_t>(sample_count);
+    const auto size = values_.GetSize();
+    uniform_.resize(size.x * size.y);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Copy the contents of the tile from the texture unpacking them
+  ///             from its pixel format. Cleared tiles are uniform without
+  ///             expanding any of their pixels.
+  ///
+  template <class Pixel>
+  void Load(const Texture<Pixel>& texture,
+            const TileClearState<T>& clear_state) {
+    if (clear_state.IsPending(values_.GetOrigin())) {
+      Clear(clear_state.GetValue());
+      return;
+    }
+    std::fill(uniform_.begin(), uniform_.end(), false);
+    if constexpr (std::is_same_v<Pixel, T>) {
+      values_.Load(texture, clear_state);
+    } else {
+      const auto origin = values_.GetOrigin();
+      const auto size = values_.GetSize();
+      const auto row_length = size.x * samples_;
+      for (auto y = 0; y < size.y; y++) {
+        const auto* row = texture.Get(origin + glm::ivec2{0, y}, 0);
+        auto* values = values_.Get(origin + glm::ivec2{0, y}, 0);
+        for (size_t i = 0; i < row_length; i++) {
+          values[i] = PixelFormatTraits<Pixel>::Unpack(row[i]);
+        }
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write the contents of the tile back to the texture packing
+  ///             them into its pixel format. All samples of uniform pixels are
+  ///             set to their value.
+  ///
+  template <class Pixel>
+  void Store(Texture<Pixel>& texture) const {
+    const auto origin = values_.GetOrigin();
+    const auto size = values_.GetSize();
+    for (auto y = 0; y < size.y; y++) {
+      auto* row = texture.Get(origin + glm::ivec2{0, y}, 0);
+      const auto* uniform = uniform_.data() + size.x * y;
+      const auto* values = values_.Get(origin + glm::ivec2{0, y}, 0);
+      for (auto x = 0; x < size.x; x++, row += samples_, values += samples_) {
+        if (uniform[x]) {
+          std::fill_n(row, samples_, PixelFormatTraits<Pixel>::Pack(values[0]));
+          continue;
+        }
+        for (size_t i = 0; i < samples_; i++) {
+          row[i] = PixelFormatTraits<Pixel>::Pack(values[i]);
+        }
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Write the average of the samples of each pixel to the single
+  ///             sampled texture. Uniform pixels are copied as they are.
+  ///
+  template <class Pixel>
+  void Resolve(Texture<Pixel>& to) const {
+    switch (GetSampleCount()) {
+      case SampleCount::kOne:
+        return ResolveRows<1u>(to);
+      case SampleCount::kTwo:
+        return ResolveRows<2u>(to);
+      case SampleCount::kFour:
+        return ResolveRows<4u>(to);
+      case SampleCount::kEight:
+        return ResolveRows<8u>(to);
+      case SampleCount::kSixteen:
+        return ResolveRows<16u>(to);
+    }
+  }
+
+  void Clear(const T& value) {
+    const auto origin = values_.GetOrigin();
+    const auto size = values_.GetSize();
+    for (auto y = 0; y < size.y; y++) {
+      for (auto x = 0; x < size.x; x++) {
+        values_.Set(value, origin + glm::ivec2{x, y}, 0);
+      }
+    }
+    std::fill(uniform_.begin(), uniform_.end(), true);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Set all samples of the pixel to the value.
+  ///
+  SFT_ALWAYS_INLINE void SetPixel(const T& value, glm::ivec2 pos) {
+    uniform_[GetPixelIndex(pos)] = true;
+    values_.Set(value, pos, 0);
+  }
+
+  SFT_ALWAYS_INLINE void Set(const T& value,
+                             glm::ivec2 pos,
+                             size_t sample_index) {
+    auto& uniform = uniform_[GetPixelIndex(pos)];
+    if (uniform) {
+      const auto* first = values_.Get(pos, 0);
+      for (size_t i = 1; i < samples_; i++) {
+        values_.Set(*first, pos, i);
+      }
+      uniform = false;
+    }
+    values_.Set(value, pos, sample_index);
+  }
+
+  SFT_ALWAYS_INLINE const T* Get(glm::ivec2 pos, size_t sample_index) const {
+    return values_.Get(pos, IsUniform(pos) ? 0u : sample_index);
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Whether all samples of the pixel have the value of its first
+  ///             sample.
+  ///
+  SFT_ALWAYS_INLINE bool IsUniform(glm::ivec2 pos) const {
+    return uniform_[GetPixelIndex(pos)];
+  }
+
+  glm::ivec2 GetOrigin() const { return values_.GetOrigin(); }
+
+  glm::ivec2 GetSize() const { return values_.GetSize(); }
+
+  SampleCount GetSampleCount() const { return values_.GetSampleCount(); }
+
+ private:
+  TileBuffer<T> values_;
+  size_t samples_ = 1u;
+  std::vector<uint8_t> uniform_;
+
+  SFT_ALWAYS_INLINE size_t GetPixelIndex(glm::ivec2 pos) const {
+    const auto local = pos - values_.GetOrigin();
+    return values_.GetSize().x * local.y + local.x;
+  }
+
+  template <size_t kSampleCount, class Pixel>
+  void ResolveRows(Texture<Pixel>& to) const {
+    const auto origin = values_.GetOrigin();
+    const auto size = values_.GetSize();
+    for (auto y = 0; y < size.y; y++) {
+      auto* row = to.Get(origin + glm::ivec2{0, y}, 0);
+      const auto* uniform = uniform_.data() + size.x * y;
+      const auto* samples = values_.Get(origin + glm::ivec2{0, y}, 0);
+      for (auto x = 0; x < size.x; x++, samples += kSampleCount) {
+        row[x] = PixelFormatTraits<Pixel>::Pack(
+            uniform[x] ? samples[0] : ResolveSamples<kSampleCount>(samples));
+      }
+    }
+  }
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(CompressedTileBuffer);
+};
+
+//------------------------------------------------------------------------------
+/// @brief      A region of the render target shaded by a single task. The
+///             attachments are loaded into tile buffers before any of its
+///             fragments are shaded and written back once all are.
+///
+struct Tile {
+  static constexpr uint32_t kNoPrimitive = 0;
+
+  //----------------------------------------------------------------------------
+  /// The half-open range of pixels of the tile within the render target.
+  ///
+  const glm::ivec2 min;
+  const glm::ivec2 max;
+  //----------------------------------------------------------------------------
+  /// The buffer of each color attachment of the render pass by location. Only
+  /// those of the attachments in the render pass are set up.
+  ///
+  std::array<CompressedTileBuffer<Color>, kMaxColorAttachments> colors;
+  TileBuffer<ScalarF> depth;
+  TileBuffer<uint8_t> stencil;
+  //----------------------------------------------------------------------------
+  /// The ID of the primitive visible at each sample. Only allocated for tiles
+  /// with primitives that defer shading. It is emptied as their fragments are
+  /// shaded. So it is never loaded or stored and lives only as long as the
+  /// tile.
+  ///
+  TileBuffer<uint32_t> visibility;
+  //----------------------------------------------------------------------------
+  /// The metrics of the fragment stage counted by this tile alone.
+  ///
+  RasterizerMetrics& metrics;
+
+  Tile(glm::ivec2 p_min, glm::ivec2 p_max, RasterizerMetrics& p_metrics)
+      : min(p_min), max(p_max), metrics(p_metrics) {}
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(Tile);
+};
+
+}  // namespace sft
@@ -5,76 +5,228 @@
 
 #include "tiler.h"
 
-#include <set>
+#include <algorithm>
 #include <vector>
 
 #include "marl/waitgroup.h"
+#include "pixel_block.h"
 #include "rasterizer.h"
 
 namespace sft {
 
+static_assert(kTileSize % kCoarseBlockSize == 0);
+static_assert(kTileSize % kHiZBlockSize == 0);
+static_assert((kTileSize / kMaxTileSplit) % kCoarseBlockSize == 0);
+
+//------------------------------------------------------------------------------
+/// The cost of a primitive in a tile beyond that of the pixels it covers.
+/// Counted in pixels.
+///
+constexpr size_t kPrimitiveTileCost = 64;
+
 Tiler::Tiler() = default;
 
 Tiler::~Tiler() = default;
 
+void Tiler::Resize(glm::ivec2 size) {
+  size_ = size;
+  grid_size_ = (size + kTileSize - 1) / kTileSize;
+  bins_.resize(grid_size_.x * grid_size_.y);
+  bin_costs_.resize(bins_.size());
+  Reset();
+}
+
+//------------------------------------------------------------------------------
+/// @brief      Whether any sample in the tile at the origin may be inside the
+///             triangle. Each edge function is checked at the corner of the
+///             tile where it is the largest.
+///
+static bool TriangleOverlapsTile(const TriangleEdges& edges,
+                                 const BlockExtents& extents,
+                                 glm::ivec2 origin) {
+  const auto largest =
+      edges.Evaluate(ToFixedPoint(origin)) + edges.bias + extents.max;
+  return largest.x >= 0 && largest.y >= 0 && largest.z >= 0;
+}
+
 void Tiler::AddData(FragmentResources frag_resources) {
-  const auto data = frag_resources_.emplace_back(std::move(frag_resources));
-  const auto min = glm::ivec2{glm::floor(data.box.GetLT())};
-  const auto max = glm::ivec2{glm::ceil(data.box.GetRB())};
-  tree_.Insert((int*)&min, (int*)&max, frag_resources_.size() - 1u);
-  min_ = glm::min(min, min_);
-  max_ = glm::max(max, max_);
+  const auto index = static_cast<uint32_t>(frag_resources_.size());
+  frag_resources.id = index + 1u;
+  const auto& data = frag_resources_.emplace_back(std::move(frag_resources));
+
+  //----------------------------------------------------------------------------
+  // Find the tiles overlapped by the bounding box. It includes its right and
+  // bottom edges and is always within the render target.
+  //----------------------------------------------------------------------------
+  const auto box_min = glm::ivec2{glm::floor(data.box.GetLT())};
+  const auto box_max = glm::ivec2{glm::ceil(data.box.GetRB())};
+  const auto min = glm::max(box_min / kTileSize, 0);
+  const auto max = glm::min(box_max / kTileSize, grid_size_ - 1);
+
+  //----------------------------------------------------------------------------
+  // Primitives that span many tiles are often thin or diagonal and miss most of
+  // the tiles of their bounding box. Only bin them in tiles they overlap.
+  //----------------------------------------------------------------------------
+  const auto exact = (max.x - min.x) > 0 && (max.y - min.y) > 0;
+  const auto extents =
+      exact ? BlockExtents{data.edges, kTileSize} : BlockExtents{};
+  for (auto y = min.y; y <= max.y; y++) {
+    for (auto x = min.x; x <= max.x; x++) {
+      if (exact && !TriangleOverlapsTile(data.edges, extents,
+                                         glm::ivec2{x, y} * kTileSize)) {
+        continue;
+      }
+      const auto tile_index = y * grid_size_.x + x;
+      bins_[tile_index].push_back(index);
+      const auto tile_min = glm::ivec2{x, y} * kTileSize;
+      const auto covered =
+          glm::max(glm::min(box_max + 1, tile_min + kTileSize) -
+                       glm::max(box_min, tile_min),
+                   0);
+      bin_costs_[tile_index] += kPrimitiveTileCost + covered.x * covered.y;
+    }
+  }
 }
 
-void Tiler::Dispatch(Rasterizer& rasterizer) {
-  const auto tile_factor = TileFactorForAvailableHardwareConcurrency();
-  const glm::ivec2 num_slices = {tile_factor, tile_factor};
-  const glm::ivec2 full_span = max_ - min_;
-  const glm::ivec2 min_span = {64, 64};
-  const glm::ivec2 span = glm::max(full_span.x / num_slices, min_span);
+const FragmentResources& Tiler::GetData(uint32_t id) const {
+  return frag_resources_[id - 1u];
+}
 
-  if (tree_.Count() == 0 || full_span.x <= 0 || full_span.y <= 0) {
+//------------------------------------------------------------------------------
+/// @brief      A square region of the render target shaded by a single task
+///             along with the primitives that may overlap it.
+///
+struct TileTask {
+  glm::ivec2 min;
+  Scalar size = kTileSize;
+  const std::vector<uint32_t>* bin = nullptr;
+  size_t cost = 0;
+};
+
+void Tiler::Dispatch(Rasterizer& rasterizer, RasterizerMetrics& metrics) {
+  if (frag_resources_.empty()) {
     return;
   }
 
-  using IndexSet = std::set<size_t, std::less<size_t>>;
-
-  marl::WaitGroup wg;
-
-  for (auto x = min_.x; x < max_.x; x += span.x) {
-    for (auto y = min_.y; y < max_.y; y += span.y) {
-      IndexSet index_set;
-      const auto min = glm::ivec2{x, y};
-      const auto max = min + span;
-      auto found = tree_.Search((int*)&min, (int*)&max,
-                                [](size_t idx, void* ctx) -> bool {
-                                  reinterpret_cast<IndexSet*>(ctx)->insert(idx);
-                                  return true;
-                                },
-                                &index_set);
-      if (found == 0) {
-        // The bounding boxes of no primitives intersect this tile.
+  //----------------------------------------------------------------------------
+  // Find the tiles with primitives and their average cost.
+  //----------------------------------------------------------------------------
+  std::vector<TileTask> tiles;
+  size_t total_cost = 0;
+  for (auto y = 0; y < grid_size_.y; y++) {
+    for (auto x = 0; x < grid_size_.x; x++) {
+      const auto tile_index = y * grid_size_.x + x;
+      if (bins_[tile_index].empty()) {
+        // No primitives overlap this tile.
         continue;
       }
-      wg.add();
-      marl::schedule([&wg, min, max, index_set = std::move(index_set),
-                      &rasterizer, frag_resources = &frag_resources_]() {
-        const auto tile = Rect::MakeLTRB(min.x, min.y, max.x, max.y);
-        for (const auto& index : index_set) {
-          rasterizer.ShadeFragments(frag_resources->at(index), tile);
-        }
-        wg.done();
+      tiles.push_back({
+          .min = glm::ivec2{x, y} * kTileSize,
+          .bin = &bins_[tile_index],
+          .cost = bin_costs_[tile_index],
       });
+      total_cost += bin_costs_[tile_index];
     }
   }
+  if (tiles.empty()) {
+    return;
+  }
+  const auto average_cost = std::max<size_t>(total_cost / tiles.size(), 1u);
+
+  //----------------------------------------------------------------------------
+  // Split tiles that cost many times the average into sub-tiles that each cost
+  // about as much as the average. Sub-tiles go through all primitives of the
+  // tile but skip those that don't overlap them right away.
+  //----------------------------------------------------------------------------
+  std::vector<TileTask> tasks;
+  tasks.reserve(tiles.size());
+  for (const auto& tile : tiles) {
+    Scalar split = 1;
+    while (split < kMaxTileSplit &&
+           tile.cost >= average_cost * (split * 2) * (split * 2)) {
+      split *= 2;
+    }
+    const auto size = kTileSize / split;
+    for (Scalar y = 0; y < split; y++) {
+      for (Scalar x = 0; x < split; x++) {
+        tasks.push_back({
+            .min = tile.min + glm::ivec2{x, y} * size,
+            .size = size,
+            .bin = tile.bin,
+            .cost = tile.cost / (split * split),
+        });
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  // Start the most expensive tasks first so that the cheap ones fill in the
+  // gaps at the end. Idle workers steal the tasks queued on busy ones.
+  //----------------------------------------------------------------------------
+  std::stable_sort(tasks.begin(), tasks.end(),
+                   [](const TileTask& lhs, const TileTask& rhs) {
+                     return lhs.cost > rhs.cost;
+                   });
+
+  //----------------------------------------------------------------------------
+  // Each task counts its metrics separately. They are merged once all tasks
+  // are done.
+  //----------------------------------------------------------------------------
+  std::vector<RasterizerMetricsShard> shards(tasks.size());
+
+  marl::WaitGroup wg(tasks.size());
+  for (size_t i = 0; i < tasks.size(); i++) {
+    marl::schedule([&wg, &task = tasks[i], &rasterizer,
+                    frag_resources = &frag_resources_, size = size_,
+                    &tile_metrics = shards[i].metrics]() {
+      const auto max = glm::min(task.min + task.size, size);
+      if (max.x <= task.min.x || max.y <= task.min.y) {
+        // Sub-tiles of tiles on the edges may be outside the render target.
+        wg.done();
+        return;
+      }
+      Tile tile(task.min, max, tile_metrics);
+      rasterizer.LoadTile(tile);
+      // Fragments in the visibility buffer must be shaded before primitives
+      // that don't defer shading draw over them.
+      bool shading_deferred = false;
+      for (const auto& index : *task.bin) {
+        const auto& data = (*frag_resources)[index];
+        if (shading_deferred && !data.defer_shading) {
+          rasterizer.ShadeVisibleFragments(tile);
+          shading_deferred = false;
+        }
+        rasterizer.ShadeFragments(data, tile);
+        shading_deferred |= data.defer_shading;
+      }
+      if (shading_deferred) {
+        rasterizer.ShadeVisibleFragments(tile);
+      }
+      rasterizer.StoreTile(tile);
+      wg.done();
+    });
+  }
   wg.wait();
+
+  //----------------------------------------------------------------------------
+  // The clears pending in the tiles have been written along with their
+  // contents. Tiles without primitives are still only cleared lazily.
+  //----------------------------------------------------------------------------
+  for (const auto& tile : tiles) {
+    rasterizer.MarkTileStored(tile.min);
+  }
+
+  for (const auto& shard : shards) {
+    metrics.Merge(shard.metrics);
+  }
 }
 
 void Tiler::Reset() {
   frag_resources_.clear();
-  tree_.RemoveAll();
-  min_ = {INT_MAX, INT_MAX};
-  max_ = {INT_MIN, INT_MIN};
+  for (auto& bin : bins_) {
+    bin.clear();
+  }
+  std::fill(bin_costs_.begin(), bin_costs_.end(), 0u);
 }
 
 }  // namespace sft
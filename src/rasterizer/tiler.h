@@ -5,43 +5,71 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "geometry.h"
 #include "macros.h"
 #include "pipeline.h"
+#include "rasterizer_metrics.h"
 #include "stage_resources.h"
-
-#define Min std::min
-#define Max std::max
-
-#ifndef __cdecl
-#define __cdecl
-#endif  // __cdecl
-
-#include <RTree.h>
+#include "tile_buffer.h"
 
 namespace sft {
 
 class Rasterizer;
 
+//------------------------------------------------------------------------------
+/// Tiles much more expensive to shade than the average are split into up to
+/// this many sub-tiles along each side so that they don't hold up the frame.
+///
+constexpr Scalar kMaxTileSplit = 4;
+
 class Tiler {
  public:
   Tiler();
 
   ~Tiler();
 
+  //----------------------------------------------------------------------------
+  /// @brief      Set the size of the render target covered by the grid of
+  ///             tiles. Discards all primitives.
+  ///
+  void Resize(glm::ivec2 size);
+
+  //----------------------------------------------------------------------------
+  /// @brief      Discard all primitives. The storage of the bins is kept for
+  ///             the next frame.
+  ///
   void Reset();
 
+  //----------------------------------------------------------------------------
+  /// @brief      Append the primitive to the bins of the tiles it overlaps.
+  ///
   void AddData(FragmentResources frag_resources);
 
-  void Dispatch(Rasterizer& rasterizer);
+  const FragmentResources& GetData(uint32_t id) const;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Shade the fragments of all primitives a tile at a time and add
+  ///             the metrics of all tiles to the ones given.
+  ///
+  void Dispatch(Rasterizer& rasterizer, RasterizerMetrics& metrics);
 
  private:
   std::vector<FragmentResources> frag_resources_;
-  RTree<size_t, int, 2> tree_;
-  glm::ivec2 min_ = {INT_MAX, INT_MAX};
-  glm::ivec2 max_ = {INT_MIN, INT_MIN};
+  glm::ivec2 size_ = {};
+  glm::ivec2 grid_size_ = {};
+  //----------------------------------------------------------------------------
+  /// The indices of the primitives overlapping each tile in the order they were
+  /// added. Tiles are in row-major order.
+  ///
+  std::vector<std::vector<uint32_t>> bins_;
+  //----------------------------------------------------------------------------
+  /// An estimate of the cost of shading each tile from the number of
+  /// primitives in its bin and the area they cover.
+  ///
+  std::vector<size_t> bin_costs_;
 
   SFT_DISALLOW_COPY_AND_ASSIGN(Tiler);
 };
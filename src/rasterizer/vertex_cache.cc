@@ -0,0 +1,18 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#include "vertex_cache.h"
+
+namespace sft {
+
+VertexCache::VertexCache(size_t varyings_stride)
+    : varyings_stride_(varyings_stride),
+      varyings_(varyings_stride * kEntryCount) {
+  indices_.fill(kNoVertex);
+}
+
+VertexCache::~VertexCache() = default;
+
+}  // namespace sft
@@ -0,0 +1,84 @@
+/*
+ *  This source file is part of the SFT project.
+ *  Licensed under the MIT License. See LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "geometry.h"
+#include "macros.h"
+
+namespace sft {
+
+//------------------------------------------------------------------------------
+/// @brief      A cache of the results of the vertex stage of an indexed draw.
+///             Neighboring primitives of a mesh usually share vertices and the
+///             vertex shader need only be invoked once for each.
+///
+///             The cache is direct-mapped on the vertex index. Meshes whose
+///             vertices are numbered in the order they are first used mostly
+///             reuse vertices before they are evicted.
+///
+class VertexCache {
+ public:
+  static constexpr size_t kEntryCount = 256;
+
+  //----------------------------------------------------------------------------
+  /// @brief      Create an empty cache for the vertices of a single draw.
+  ///
+  /// @param[in]  varyings_stride  The size of the varyings of one vertex.
+  ///
+  explicit VertexCache(size_t varyings_stride);
+
+  ~VertexCache();
+
+  //----------------------------------------------------------------------------
+  /// @brief      Copy the results of the vertex stage for a vertex if cached.
+  ///
+  /// @param[in]  index     The index of the vertex in the vertex buffer.
+  /// @param[out] position  The clip-space position of the vertex.
+  /// @param[out] varyings  The varyings of the vertex.
+  ///
+  /// @return     If the vertex was found.
+  ///
+  bool Load(size_t index, glm::vec4& position, uint8_t* varyings) const {
+    const auto entry = index % kEntryCount;
+    if (indices_[entry] != index) {
+      return false;
+    }
+    position = positions_[entry];
+    std::memcpy(varyings, varyings_.data() + entry * varyings_stride_,
+                varyings_stride_);
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  /// @brief      Cache the results of the vertex stage for a vertex. Evicts
+  ///             any other vertex in the same entry.
+  ///
+  void Store(size_t index, const glm::vec4& position, const uint8_t* varyings) {
+    const auto entry = index % kEntryCount;
+    indices_[entry] = index;
+    positions_[entry] = position;
+    std::memcpy(varyings_.data() + entry * varyings_stride_, varyings,
+                varyings_stride_);
+  }
+
+ private:
+  static constexpr size_t kNoVertex = std::numeric_limits<size_t>::max();
+
+  const size_t varyings_stride_;
+  std::array<size_t, kEntryCount> indices_;
+  std::array<glm::vec4, kEntryCount> positions_;
+  std::vector<uint8_t> varyings_;
+
+  SFT_DISALLOW_COPY_AND_ASSIGN(VertexCache);
+};
+
+}  // namespace sft